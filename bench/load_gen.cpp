@@ -0,0 +1,366 @@
+// HTTP load generator for wallet_api
+// Build and run: make bench
+//
+// Usage: load_gen [options]
+//   --server PATH        start this wallet_api binary against the embedded NBP stub
+//   --host HOST          target host (default 127.0.0.1)
+//   --port PORT          target port (default 18090)
+//   --concurrency N      client threads (default 8)
+//   --users N            distinct API keys to spread requests over (default all keys)
+//   --api-keys K1,K2     API keys to use (default key-123,key-456,key-789)
+//   --duration SEC       measured run time (default 10)
+//   --warmup SEC         unmeasured warm-up time (default 2)
+//   --read-ratio R       share of GET /wallet, the rest is split between add and sub (default 0.8)
+//   --output FILE        write results as JSON (default bench_results.json)
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <csignal>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../third_party/httplib.h"
+#include "../third_party/json.hpp"
+#include "nbp_stub.h"
+
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string server;
+    std::string host = "127.0.0.1";
+    int port = 18090;
+    int concurrency = 8;
+    int users = 0;
+    std::vector<std::string> api_keys = {"key-123", "key-456", "key-789"};
+    double duration_sec = 10.0;
+    double warmup_sec = 2.0;
+    double read_ratio = 0.8;
+    std::string output = "bench_results.json";
+};
+
+enum Operation { OP_GET = 0, OP_ADD, OP_SUB, OP_COUNT };
+static const char* OPERATION_NAMES[OP_COUNT] = {"get", "add", "sub"};
+
+// Per-thread results, merged after the run
+struct WorkerStats {
+    std::vector<uint32_t> latencies_us[OP_COUNT];
+    uint64_t errors[OP_COUNT] = {};
+    uint64_t rejected[OP_COUNT] = {};
+    uint64_t shed[OP_COUNT] = {};     // 503 from admission control
+};
+
+static std::vector<std::string> split(const std::string& value, char separator) {
+    std::vector<std::string> parts;
+    std::stringstream stream(value);
+    std::string part;
+    while (std::getline(stream, part, separator)) {
+        if (!part.empty()) {
+            parts.push_back(part);
+        }
+    }
+    return parts;
+}
+
+static bool parseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Missing value for %s\n", arg.c_str());
+            return false;
+        }
+        std::string value = argv[++i];
+
+        if (arg == "--server") options.server = value;
+        else if (arg == "--host") options.host = value;
+        else if (arg == "--port") options.port = std::atoi(value.c_str());
+        else if (arg == "--concurrency") options.concurrency = std::max(1, std::atoi(value.c_str()));
+        else if (arg == "--users") options.users = std::atoi(value.c_str());
+        else if (arg == "--api-keys") options.api_keys = split(value, ',');
+        else if (arg == "--duration") options.duration_sec = std::atof(value.c_str());
+        else if (arg == "--warmup") options.warmup_sec = std::atof(value.c_str());
+        else if (arg == "--read-ratio") options.read_ratio = std::atof(value.c_str());
+        else if (arg == "--output") options.output = value;
+        else {
+            fprintf(stderr, "Unknown option %s\n", arg.c_str());
+            return false;
+        }
+    }
+
+    if (options.users > 0) {
+        if (static_cast<size_t>(options.users) > options.api_keys.size()) {
+            fprintf(stderr, "Only %zu API keys available, using %zu users\n", options.api_keys.size(), options.api_keys.size());
+        } else {
+            options.api_keys.resize(options.users);
+        }
+    }
+    return !options.api_keys.empty();
+}
+
+// Start wallet_api with a scratch database pointed at the stub
+static pid_t startServer(const Options& options, const std::string& nbp_base_url, const std::string& db_path) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        setenv("NBP_BASE_URL", nbp_base_url.c_str(), 1);
+        setenv("WALLET_DB_PATH", db_path.c_str(), 1);
+        setenv("WALLET_PORT", std::to_string(options.port).c_str(), 1);
+        setenv("WALLET_LOG_LEVEL", "warn", 0);
+        execl(options.server.c_str(), options.server.c_str(), static_cast<char*>(nullptr));
+        perror("execl");
+        _exit(127);
+    }
+    return pid;
+}
+
+static bool waitForServer(const Options& options, pid_t server_pid, double timeout_sec) {
+    httplib::Client client(options.host, options.port);
+    client.set_connection_timeout(0, 200000);
+    auto deadline = Clock::now() + std::chrono::duration<double>(timeout_sec);
+    while (Clock::now() < deadline) {
+        if (server_pid > 0 && waitpid(server_pid, nullptr, WNOHANG) == server_pid) {
+            fprintf(stderr, "%s exited during startup\n", options.server.c_str());
+            return false;
+        }
+        auto res = client.Get("/health");
+        if (res && res->status == 200) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    return false;
+}
+
+// Give every user enough funds that sub requests don't run dry
+static bool seedWallets(const Options& options) {
+    httplib::Client client(options.host, options.port);
+    for (const std::string& key : options.api_keys) {
+        for (const char* currency : {"USD", "EUR", "GBP", "CHF"}) {
+            json body = {{"currency", currency}, {"amount", 1e9}};
+            auto res = client.Post("/wallet/add", {{"X-API-Key", key}}, body.dump(), "application/json");
+            if (!res || res->status != 200) {
+                fprintf(stderr, "Failed to seed wallet for %s\n", key.c_str());
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void runWorker(const Options& options, int worker_id, std::atomic<bool>& measuring,
+                      std::atomic<bool>& stop, WorkerStats& stats) {
+    httplib::Client client(options.host, options.port);
+    client.set_keep_alive(true);
+    client.set_tcp_nodelay(true);
+
+    std::mt19937 rng(static_cast<unsigned>(worker_id) * 7919u + 17u);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::uniform_int_distribution<size_t> pick_user(0, options.api_keys.size() - 1);
+    static const char* currencies[] = {"USD", "EUR", "GBP", "CHF"};
+
+    while (!stop.load(std::memory_order_relaxed)) {
+        const std::string& key = options.api_keys[pick_user(rng)];
+        double roll = unit(rng);
+        Operation op = roll < options.read_ratio ? OP_GET
+                     : (roll < options.read_ratio + (1.0 - options.read_ratio) / 2 ? OP_ADD : OP_SUB);
+
+        httplib::Headers headers = {{"X-API-Key", key}};
+        auto start = Clock::now();
+        httplib::Result res;
+        if (op == OP_GET) {
+            res = client.Get("/wallet", headers);
+        } else {
+            char body[64];
+            snprintf(body, sizeof(body), "{\"currency\":\"%s\",\"amount\":%.2f}", currencies[rng() % 4], 1.0 + unit(rng) * 10);
+            res = client.Post(op == OP_ADD ? "/wallet/add" : "/wallet/sub", headers, body, "application/json");
+        }
+        auto elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+
+        if (!measuring.load(std::memory_order_relaxed)) {
+            continue;
+        }
+        if (!res) {
+            stats.errors[op]++;
+            continue;
+        }
+        if (res->status == 503) {
+            stats.shed[op]++;
+        } else if (res->status >= 500) {
+            stats.errors[op]++;
+        } else if (res->status >= 400) {
+            stats.rejected[op]++;
+        }
+        stats.latencies_us[op].push_back(static_cast<uint32_t>(elapsed_us));
+    }
+}
+
+static double percentile(const std::vector<uint32_t>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0.0;
+    }
+    size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)] / 1000.0;
+}
+
+static json summarize(std::vector<uint32_t>& latencies, uint64_t errors, uint64_t rejected, uint64_t shed,
+                      double duration_sec) {
+    std::sort(latencies.begin(), latencies.end());
+    double total_ms = 0.0;
+    for (uint32_t us : latencies) {
+        total_ms += us / 1000.0;
+    }
+
+    json out;
+    out["requests"] = latencies.size();
+    out["errors"] = errors;
+    out["rejected_4xx"] = rejected;
+    out["shed_503"] = shed;
+    out["rps"] = latencies.size() / duration_sec;
+    out["latency_ms"] = {
+        {"mean", latencies.empty() ? 0.0 : total_ms / latencies.size()},
+        {"p50", percentile(latencies, 0.50)},
+        {"p99", percentile(latencies, 0.99)},
+        {"p999", percentile(latencies, 0.999)},
+        {"max", latencies.empty() ? 0.0 : latencies.back() / 1000.0},
+    };
+    return out;
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        return 1;
+    }
+
+    NBPStub stub;
+    pid_t server_pid = -1;
+    std::string db_path;
+
+    if (!options.server.empty()) {
+        if (!stub.start()) {
+            fprintf(stderr, "Failed to start NBP stub\n");
+            return 1;
+        }
+        char db_template[] = "/tmp/wallet_bench_XXXXXX";
+        if (!mkdtemp(db_template)) {
+            perror("mkdtemp");
+            return 1;
+        }
+        db_path = std::string(db_template) + "/wallet.db";
+        server_pid = startServer(options, stub.baseUrl(), db_path);
+        printf("Started %s (pid %d), NBP stub at %s\n", options.server.c_str(), server_pid, stub.baseUrl().c_str());
+    }
+
+    int exit_code = 0;
+    if (!waitForServer(options, server_pid, 10.0) || !seedWallets(options)) {
+        fprintf(stderr, "Server at %s:%d is not usable\n", options.host.c_str(), options.port);
+        exit_code = 1;
+    } else {
+        printf("Running %d connections, %zu users, read ratio %.2f: %.0fs warm-up, %.0fs measured\n",
+               options.concurrency, options.api_keys.size(), options.read_ratio, options.warmup_sec, options.duration_sec);
+
+        std::atomic<bool> measuring{false};
+        std::atomic<bool> stop{false};
+        std::vector<WorkerStats> stats(options.concurrency);
+        std::vector<std::thread> workers;
+        for (int i = 0; i < options.concurrency; i++) {
+            workers.emplace_back(runWorker, std::cref(options), i, std::ref(measuring), std::ref(stop), std::ref(stats[i]));
+        }
+
+        std::this_thread::sleep_for(std::chrono::duration<double>(options.warmup_sec));
+        measuring = true;
+        auto start = Clock::now();
+        std::this_thread::sleep_for(std::chrono::duration<double>(options.duration_sec));
+        measuring = false;
+        double measured_sec = std::chrono::duration<double>(Clock::now() - start).count();
+        stop = true;
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        // Merge per-thread results
+        std::vector<uint32_t> all;
+        std::vector<uint32_t> per_op[OP_COUNT];
+        uint64_t errors[OP_COUNT] = {};
+        uint64_t rejected[OP_COUNT] = {};
+        uint64_t shed[OP_COUNT] = {};
+        for (WorkerStats& s : stats) {
+            for (int op = 0; op < OP_COUNT; op++) {
+                per_op[op].insert(per_op[op].end(), s.latencies_us[op].begin(), s.latencies_us[op].end());
+                errors[op] += s.errors[op];
+                rejected[op] += s.rejected[op];
+                shed[op] += s.shed[op];
+            }
+        }
+
+        json results;
+        results["timestamp"] = static_cast<int64_t>(time(nullptr));
+        results["config"] = {
+            {"concurrency", options.concurrency},
+            {"users", options.api_keys.size()},
+            {"read_ratio", options.read_ratio},
+            {"duration_sec", measured_sec},
+            {"server", options.server.empty() ? options.host + ":" + std::to_string(options.port) : options.server},
+        };
+
+        uint64_t total_errors = 0;
+        uint64_t total_rejected = 0;
+        uint64_t total_shed = 0;
+        results["operations"] = json::object();
+        for (int op = 0; op < OP_COUNT; op++) {
+            all.insert(all.end(), per_op[op].begin(), per_op[op].end());
+            total_errors += errors[op];
+            total_rejected += rejected[op];
+            total_shed += shed[op];
+            results["operations"][OPERATION_NAMES[op]] = summarize(per_op[op], errors[op], rejected[op], shed[op], measured_sec);
+        }
+        results["total"] = summarize(all, total_errors, total_rejected, total_shed, measured_sec);
+        if (server_pid > 0) {
+            results["nbp_stub_requests"] = stub.requests();
+        }
+
+        const json& total = results["total"];
+        printf("\n%-6s %10s %10s %10s %10s %10s %8s %8s\n", "op", "requests", "rps", "p50 ms", "p99 ms", "p999 ms", "errors", "503");
+        for (int op = 0; op < OP_COUNT; op++) {
+            const json& r = results["operations"][OPERATION_NAMES[op]];
+            printf("%-6s %10llu %10.0f %10.3f %10.3f %10.3f %8llu %8llu\n", OPERATION_NAMES[op],
+                   r["requests"].get<unsigned long long>(), r["rps"].get<double>(),
+                   r["latency_ms"]["p50"].get<double>(), r["latency_ms"]["p99"].get<double>(),
+                   r["latency_ms"]["p999"].get<double>(), r["errors"].get<unsigned long long>(),
+                   r["shed_503"].get<unsigned long long>());
+        }
+        printf("%-6s %10llu %10.0f %10.3f %10.3f %10.3f %8llu %8llu\n", "total",
+               total["requests"].get<unsigned long long>(), total["rps"].get<double>(),
+               total["latency_ms"]["p50"].get<double>(), total["latency_ms"]["p99"].get<double>(),
+               total["latency_ms"]["p999"].get<double>(), total["errors"].get<unsigned long long>(),
+               total["shed_503"].get<unsigned long long>());
+
+        FILE* out = fopen(options.output.c_str(), "w");
+        if (out) {
+            std::string text = results.dump(2);
+            fwrite(text.data(), 1, text.size(), out);
+            fclose(out);
+            printf("\nResults written to %s\n", options.output.c_str());
+        } else {
+            perror("fopen");
+            exit_code = 1;
+        }
+    }
+
+    if (server_pid > 0) {
+        kill(server_pid, SIGTERM);
+        waitpid(server_pid, nullptr, 0);
+        unlink(db_path.c_str());
+        unlink((db_path + "-wal").c_str());
+        unlink((db_path + "-shm").c_str());
+        rmdir(db_path.substr(0, db_path.rfind('/')).c_str());
+    }
+    return exit_code;
+}
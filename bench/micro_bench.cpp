@@ -0,0 +1,441 @@
+// Microbenchmarks for wallet hot paths
+// Build and run: make microbench
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <dirent.h>
+#include "../third_party/httplib.h"
+#include "../third_party/json.hpp"
+#include "../src/currency.h"
+#include "../src/database.h"
+#include "../src/auth.h"
+#include "../src/validation.h"
+#include "../src/wallet_response.h"
+#include "../src/logger.h"
+#include "../src/utils.h"
+
+using json = nlohmann::json;
+
+// Thread counts for the contended variants
+static const int THREAD_COUNTS[] = {1, 2, 4, 8};
+
+// Prevent the compiler from optimizing away a result
+static volatile double sink;
+
+// Run fn until at least min_ms have passed and record ns per call
+static void runBench(const std::string& name, const std::function<void()>& fn, int min_ms = 200) {
+    using clock = std::chrono::steady_clock;
+
+    // Warm up, bounded in time as well since some cases wait on fsync
+    auto warmup_end = clock::now() + std::chrono::milliseconds(min_ms / 4);
+    for (int i = 0; i < 1000 && clock::now() < warmup_end; i++) {
+        fn();
+    }
+
+    // Grow the batch so cheap cases don't spend their time reading the clock
+    uint64_t iterations = 0;
+    uint64_t batch = 1;
+    auto start = clock::now();
+    double elapsed_ns = 0.0;
+    while (elapsed_ns < min_ms * 1e6) {
+        for (uint64_t i = 0; i < batch; i++) {
+            fn();
+        }
+        iterations += batch;
+        batch = std::min<uint64_t>(batch * 2, 1000);
+        elapsed_ns = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+    }
+
+    double ns_per_op = elapsed_ns / iterations;
+    std::printf("%-60s %12.1f ns/op\n", name.c_str(), ns_per_op);
+}
+
+// Run fn(thread_index) on several threads for min_ms, report per-thread ns per call and total throughput
+static void runParallelBench(const std::string& name, int threads, const std::function<void(int)>& fn, int min_ms = 200) {
+    using clock = std::chrono::steady_clock;
+
+    struct alignas(64) Count {
+        uint64_t value = 0;
+    };
+    std::vector<Count> counts(threads);
+    std::atomic<int> ready{0};
+    std::atomic<bool> go{false};
+    std::atomic<bool> stop{false};
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            ready++;
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            uint64_t local = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                fn(t);
+                local++;
+            }
+            counts[t].value = local;
+        });
+    }
+
+    while (ready.load() < threads) {
+        std::this_thread::yield();
+    }
+    auto start = clock::now();
+    go.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(std::chrono::milliseconds(min_ms));
+    stop = true;
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    double elapsed_ns = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+
+    uint64_t total = 0;
+    for (const Count& count : counts) {
+        total += count.value;
+    }
+    double ns_per_op = total > 0 ? elapsed_ns * threads / total : 0.0;
+    double ops_per_sec = total / (elapsed_ns / 1e9);
+    std::printf("%-60s %12.1f ns/op %12.0f ops/s\n",
+                (name + " [" + std::to_string(threads) + " threads]").c_str(), ns_per_op, ops_per_sec);
+}
+
+// Currency codes from NBP Table C
+static const std::vector<std::string> TABLE_C_CODES = {
+    "USD", "AUD", "CAD", "EUR", "HUF", "CHF", "GBP", "JPY", "CZK", "DKK", "NOK", "SEK", "XDR"
+};
+
+static std::vector<std::string> walletCodes(size_t size) {
+    // Table C codes first, then made-up codes for bigger wallets
+    std::vector<std::string> codes;
+    for (size_t i = 0; i < size; i++) {
+        if (i < TABLE_C_CODES.size()) {
+            codes.push_back(TABLE_C_CODES[i]);
+        } else {
+            codes.push_back(std::string("Q") + static_cast<char>('A' + i / 26 % 26) + static_cast<char>('A' + i % 26));
+        }
+    }
+    return codes;
+}
+
+static void benchValuation(size_t wallet_size) {
+    std::vector<std::string> codes = walletCodes(wallet_size);
+
+    std::map<std::string, double> map_rates;
+    RateTable flat_rates;
+    for (size_t i = 0; i < TABLE_C_CODES.size(); i++) {
+        map_rates[TABLE_C_CODES[i]] = 1.0 + i * 0.1;
+        flat_rates.set(CurrencyCode::fromString(TABLE_C_CODES[i]), 1.0 + i * 0.1);
+    }
+
+    std::map<std::string, double> map_wallet;
+    Balances flat_wallet;
+    for (size_t i = 0; i < codes.size(); i++) {
+        map_wallet[codes[i]] = 100.0 + i;
+        flat_wallet[CurrencyCode::fromString(codes[i])] = 100.0 + i;
+    }
+
+    std::string suffix = " (" + std::to_string(wallet_size) + " currencies)";
+
+    runBench("valuation/std::map" + suffix, [&] {
+        double total = 0.0;
+        for (auto& [currency, amount] : map_wallet) {
+            auto it = map_rates.find(currency);
+            if (it == map_rates.end()) {
+                continue;
+            }
+            total += amount * it->second;
+        }
+        sink = total;
+    });
+
+    runBench("valuation/flat" + suffix, [&] {
+        double total = 0.0;
+        for (const Balances::Entry& entry : flat_wallet) {
+            total += entry.amount * flat_rates.get(entry.code);
+        }
+        sink = total;
+    });
+}
+
+static void benchBalanceUpdate(size_t wallet_size) {
+    std::vector<std::string> codes = walletCodes(wallet_size);
+
+    std::map<std::string, double> map_wallet;
+    Balances flat_wallet;
+    for (size_t i = 0; i < codes.size(); i++) {
+        map_wallet[codes[i]] = 100.0;
+        flat_wallet[CurrencyCode::fromString(codes[i])] = 100.0;
+    }
+
+    // Request bodies carry the code as a string, include the conversion
+    std::string currency = codes[codes.size() / 2];
+    std::string suffix = " (" + std::to_string(wallet_size) + " currencies)";
+
+    runBench("balance update/std::map" + suffix, [&] {
+        map_wallet[currency] += 1.0;
+        sink = map_wallet[currency];
+    });
+
+    runBench("balance update/flat" + suffix, [&] {
+        double& balance = flat_wallet[CurrencyCode::fromString(currency)];
+        balance += 1.0;
+        sink = balance;
+    });
+}
+
+static RateTable tableCRates() {
+    RateTable rates;
+    for (size_t i = 0; i < TABLE_C_CODES.size(); i++) {
+        rates.set(CurrencyCode::fromString(TABLE_C_CODES[i]), 1.0 + i * 0.1);
+    }
+    return rates;
+}
+
+static void benchRateLookup() {
+    std::map<std::string, double> map_rates;
+    RateTable flat_rates = tableCRates();
+    for (size_t i = 0; i < TABLE_C_CODES.size(); i++) {
+        map_rates[TABLE_C_CODES[i]] = 1.0 + i * 0.1;
+    }
+
+    // Codes arrive as strings from request bodies, include the conversion
+    for (int threads : THREAD_COUNTS) {
+        runParallelBench("rate lookup/std::map", threads, [&](int t) {
+            static thread_local size_t next = 0;
+            const std::string& code = TABLE_C_CODES[(next++ + t) % TABLE_C_CODES.size()];
+            sink = map_rates.find(code)->second;
+        });
+        runParallelBench("rate lookup/flat", threads, [&](int t) {
+            static thread_local size_t next = 0;
+            const std::string& code = TABLE_C_CODES[(next++ + t) % TABLE_C_CODES.size()];
+            sink = flat_rates.get(CurrencyCode::fromString(code));
+        });
+    }
+}
+
+static void benchWalletResponse(size_t wallet_size) {
+    RateTable rates = tableCRates();
+    Balances wallet;
+    std::vector<std::string> codes = walletCodes(std::min(wallet_size, TABLE_C_CODES.size()));
+    for (size_t i = 0; i < codes.size(); i++) {
+        wallet[CurrencyCode::fromString(codes[i])] = 1234.56 + i;
+    }
+
+    std::string suffix = " (" + std::to_string(codes.size()) + " currencies)";
+
+    runBench("wallet response/build" + suffix, [&] {
+        json response = buildWalletResponse(wallet, rates);
+        sink = response.size();
+    });
+
+    runBench("wallet response/build+dump(2)" + suffix, [&] {
+        std::string body = buildWalletResponse(wallet, rates).dump(2);
+        sink = body.size();
+    });
+
+    runBench("wallet response/build+dump()" + suffix, [&] {
+        std::string body = buildWalletResponse(wallet, rates).dump();
+        sink = body.size();
+    });
+
+    for (int threads : THREAD_COUNTS) {
+        runParallelBench("wallet response/build+dump(2)" + suffix, threads, [&](int) {
+            std::string body = buildWalletResponse(wallet, rates).dump(2);
+            sink = body.size();
+        });
+    }
+}
+
+static void benchRequestParse() {
+    const std::string body = "{\"currency\":\"usd\",\"amount\":123.45}";
+
+    runBench("request/json::parse", [&] {
+        json data = json::parse(body);
+        sink = data.size();
+    });
+
+    runBench("request/json::parse+validate", [&] {
+        json data = json::parse(body);
+        WalletOperation op;
+        json error_response;
+        sink = validateWalletOperation(data, op, error_response) ? op.amount : 0.0;
+    });
+
+    runBench("request/parseWalletOperationFast", [&] {
+        WalletOperation op;
+        sink = parseWalletOperationFast(body.data(), body.size(), op) ? op.amount : 0.0;
+    });
+
+    for (int threads : THREAD_COUNTS) {
+        runParallelBench("request/parseWalletOperationFast", threads, [&](int) {
+            WalletOperation op;
+            sink = parseWalletOperationFast(body.data(), body.size(), op) ? op.amount : 0.0;
+        });
+        runParallelBench("request/json::parse+validate", threads, [&](int) {
+            json data = json::parse(body);
+            WalletOperation op;
+            json error_response;
+            sink = validateWalletOperation(data, op, error_response) ? op.amount : 0.0;
+        });
+    }
+}
+
+static void benchAuthenticate() {
+    httplib::Request valid;
+    valid.headers.emplace("Content-Type", "application/json");
+    valid.headers.emplace("X-API-Key", "key-456");
+    httplib::Request invalid;
+    invalid.headers.emplace("X-API-Key", "invalid-key");
+
+    runBench("auth/valid key", [&] {
+        httplib::Response res;
+        sink = authenticateRequest(valid, res).size();
+    });
+
+    runBench("auth/invalid key (401 body)", [&] {
+        httplib::Response res;
+        sink = authenticateRequest(invalid, res).size();
+    });
+
+    for (int threads : THREAD_COUNTS) {
+        runParallelBench("auth/valid key", threads, [&](int) {
+            httplib::Response res;
+            sink = authenticateRequest(valid, res).size();
+        });
+    }
+}
+
+static void benchDatabase(const std::string& engine, size_t wallet_size) {
+    std::vector<std::string> codes = walletCodes(wallet_size);
+    std::string user = "bench-load-" + std::to_string(wallet_size);
+    for (size_t i = 0; i < codes.size(); i++) {
+        saveCurrencyToDB(user, codes[i], 100.0 + i);
+    }
+
+    std::string suffix = " (" + std::to_string(wallet_size) + " currencies)";
+
+    for (int threads : THREAD_COUNTS) {
+        runParallelBench("db/" + engine + "/loadWalletFromDB" + suffix, threads, [&](int) {
+            Balances wallet;
+            loadWalletFromDB(user, wallet);
+            sink = wallet.size();
+        });
+    }
+}
+
+static void benchDatabaseWrite(const std::string& engine) {
+    // One user per thread, like independent requests that the group committer can batch
+    for (int threads : THREAD_COUNTS) {
+        runParallelBench("db/" + engine + "/saveCurrencyToDB", threads, [&](int t) {
+            static thread_local double amount = 0.0;
+            amount += 1.0;
+            sink = saveCurrencyToDB("bench-write-" + std::to_string(t), "USD", amount);
+        }, 500);
+    }
+
+    runBench("db/" + engine + "/save+load round-trip", [&] {
+        static double amount = 0.0;
+        amount += 1.0;
+        saveCurrencyToDB("bench-roundtrip", "EUR", amount);
+        Balances wallet;
+        loadWalletFromDB("bench-roundtrip", wallet);
+        sink = wallet.size();
+    }, 500);
+}
+
+// Remove a scratch directory and the files in it
+static void removeDirectory(const std::string& path) {
+    if (DIR* dir = opendir(path.c_str())) {
+        while (dirent* entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name != "." && name != "..") {
+                unlink((path + "/" + name).c_str());
+            }
+        }
+        closedir(dir);
+    }
+    rmdir(path.c_str());
+}
+
+int main(int argc, char** argv) {
+    // Optional filter: only run benchmarks whose group matches, e.g. "db" or "wallet response"
+    std::string filter = argc > 1 ? argv[1] : "";
+    auto enabled = [&](const char* group) {
+        return filter.empty() || filter == group;
+    };
+
+    // Keep per-request warnings (missing rates) out of the measurements
+    setLogLevel(LogLevel::Error);
+
+    std::printf("%-60s %15s\n", "benchmark", "time");
+
+    if (enabled("valuation")) {
+        for (size_t size : {1, 4, 8, 16}) {
+            benchValuation(size);
+        }
+    }
+    if (enabled("balance")) {
+        for (size_t size : {1, 4, 8, 16}) {
+            benchBalanceUpdate(size);
+        }
+    }
+    if (enabled("rates")) {
+        benchRateLookup();
+    }
+    if (enabled("wallet response")) {
+        for (size_t size : {1, 4, 13}) {
+            benchWalletResponse(size);
+        }
+    }
+    if (enabled("request")) {
+        benchRequestParse();
+    }
+    if (enabled("auth")) {
+        benchAuthenticate();
+    }
+
+    if (enabled("db")) {
+        // Scratch database unless WALLET_DB_PATH points somewhere else
+        char scratch_dir[] = "/tmp/wallet_micro_bench_XXXXXX";
+        std::string db_path = getEnvString("WALLET_DB_PATH", "");
+        bool scratch = db_path.empty() && mkdtemp(scratch_dir) != nullptr;
+        if (scratch) {
+            db_path = std::string(scratch_dir) + "/wallet.db";
+        }
+        setDatabasePath(db_path);
+
+        // Same benchmarks against every storage engine
+        for (const char* engine : {"sqlite", "journal"}) {
+            setStorageEngine(engine);
+            if (!initDatabase()) {
+                std::fprintf(stderr, "Failed to open %s with the %s engine\n", db_path.c_str(), engine);
+                return 1;
+            }
+            for (size_t size : {1, 4, 16, 64}) {
+                benchDatabase(engine, size);
+            }
+            benchDatabaseWrite(engine);
+            closeDatabase();
+        }
+
+        if (scratch) {
+            for (const char* suffix : {"", "-wal", "-shm"}) {
+                unlink((db_path + suffix).c_str());
+            }
+            removeDirectory(db_path + ".journal");
+            removeDirectory(db_path + ".peers");
+            rmdir(scratch_dir);
+        }
+    }
+
+    return 0;
+}
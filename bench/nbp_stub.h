@@ -0,0 +1,133 @@
+#ifndef NBP_STUB_H
+#define NBP_STUB_H
+
+// Local stand-in for api.nbp.pl serving canned rates, so benchmarks
+// don't depend on (or hammer) the real API
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include "../third_party/httplib.h"
+#include "../third_party/json.hpp"
+
+struct StubRate {
+    const char* code;
+    const char* name;
+    double bid;
+    double ask;
+    double mid;
+};
+
+// Snapshot of NBP Table C with Table A mid rates for the same currencies
+static const StubRate STUB_RATES[] = {
+    {"USD", "dolar amerykański", 3.6012, 3.6740, 3.6376},
+    {"AUD", "dolar australijski", 2.3521, 2.3996, 2.3758},
+    {"CAD", "dolar kanadyjski", 2.5801, 2.6322, 2.6061},
+    {"EUR", "euro", 4.2174, 4.3026, 4.2600},
+    {"HUF", "forint (Węgry)", 0.010812, 0.011030, 0.010921},
+    {"CHF", "frank szwajcarski", 4.5110, 4.6022, 4.5566},
+    {"GBP", "funt szterling", 4.8420, 4.9398, 4.8909},
+    {"JPY", "jen (Japonia)", 0.023750, 0.024230, 0.023990},
+    {"CZK", "korona czeska", 0.1727, 0.1761, 0.1744},
+    {"DKK", "korona duńska", 0.5651, 0.5765, 0.5708},
+    {"NOK", "korona norweska", 0.3571, 0.3643, 0.3607},
+    {"SEK", "korona szwedzka", 0.3838, 0.3916, 0.3877},
+    {"XDR", "SDR (MFW)", 4.9300, 5.0296, 4.9798},
+};
+
+// Table B currencies (mid only), valued through the on-demand fallback
+static const StubRate STUB_TABLE_B[] = {
+    {"AED", "dirham ZEA (Zjednoczone Emiraty Arabskie)", 0.0, 0.0, 0.9904},
+    {"ISK", "korona islandzka", 0.0, 0.0, 0.02651},
+    {"UAH", "hrywna (Ukraina)", 0.0, 0.0, 0.08812},
+};
+
+class NBPStub {
+public:
+    // Bind to a free local port and serve in a background thread
+    bool start() {
+        server_.Get("/api/exchangerates/tables/c/", [this](const httplib::Request&, httplib::Response& res) {
+            requests_++;
+            res.set_content(tableC(), "application/json");
+        });
+
+        server_.Get("/api/exchangerates/tables/a/", [this](const httplib::Request&, httplib::Response& res) {
+            requests_++;
+            res.set_content(midTable("A", STUB_RATES, sizeof(STUB_RATES) / sizeof(STUB_RATES[0])), "application/json");
+        });
+
+        server_.Get("/api/exchangerates/tables/b/", [this](const httplib::Request&, httplib::Response& res) {
+            requests_++;
+            res.set_content(midTable("B", STUB_TABLE_B, sizeof(STUB_TABLE_B) / sizeof(STUB_TABLE_B[0])), "application/json");
+        });
+
+        server_.Get(R"(/api/exchangerates/rates/a/([A-Za-z]{3})/)", [this](const httplib::Request& req, httplib::Response& res) {
+            requests_++;
+            std::string code = req.matches[1];
+            for (char& c : code) {
+                c = static_cast<char>(toupper(c));
+            }
+            for (const StubRate& rate : STUB_RATES) {
+                if (code == rate.code) {
+                    nlohmann::json body;
+                    body["table"] = "A";
+                    body["code"] = rate.code;
+                    body["rates"] = {{{"no", "200/A/NBP/2026"}, {"effectiveDate", "2026-10-16"}, {"mid", rate.mid}}};
+                    res.set_content(body.dump(), "application/json");
+                    return;
+                }
+            }
+            res.status = 404;
+            res.set_content("404 NotFound - Not Found - Brak danych", "text/plain");
+        });
+
+        port_ = server_.bind_to_any_port("127.0.0.1");
+        if (port_ <= 0) {
+            return false;
+        }
+        thread_ = std::thread([this] { server_.listen_after_bind(); });
+        server_.wait_until_ready();
+        return true;
+    }
+
+    void stop() {
+        server_.stop();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    ~NBPStub() { stop(); }
+
+    // Value for NBP_BASE_URL
+    std::string baseUrl() const { return "http://127.0.0.1:" + std::to_string(port_) + "/api"; }
+    uint64_t requests() const { return requests_.load(); }
+
+private:
+    static std::string tableC() {
+        nlohmann::json rates = nlohmann::json::array();
+        for (const StubRate& rate : STUB_RATES) {
+            rates.push_back({{"currency", rate.name}, {"code", rate.code}, {"bid", rate.bid}, {"ask", rate.ask}});
+        }
+        nlohmann::json table = {{"table", "C"}, {"no", "200/C/NBP/2026"}, {"tradingDate", "2026-10-15"},
+                                {"effectiveDate", "2026-10-16"}, {"rates", rates}};
+        return nlohmann::json::array({table}).dump();
+    }
+
+    static std::string midTable(const char* name, const StubRate* stub_rates, size_t count) {
+        nlohmann::json rates = nlohmann::json::array();
+        for (size_t i = 0; i < count; i++) {
+            rates.push_back({{"currency", stub_rates[i].name}, {"code", stub_rates[i].code}, {"mid", stub_rates[i].mid}});
+        }
+        nlohmann::json table = {{"table", name}, {"no", std::string("200/") + name + "/NBP/2026"},
+                                {"effectiveDate", "2026-10-16"}, {"rates", rates}};
+        return nlohmann::json::array({table}).dump();
+    }
+
+    httplib::Server server_;
+    std::thread thread_;
+    int port_ = 0;
+    std::atomic<uint64_t> requests_{0};
+};
+
+#endif // NBP_STUB_H
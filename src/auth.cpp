@@ -1,39 +1,281 @@
 #include "auth.h"
-#include <map>
+#include "response_encoder.h"
+#include "logger.h"
+#include "metrics.h"
+#include "published.h"
+#include "tracing.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <sstream>
 #include "../third_party/json.hpp"
 
 using json = nlohmann::json;
 
-const std::map<std::string, std::string> VALID_API_KEYS = {
+// Used when no key file is configured
+static const std::pair<const char*, const char*> DEFAULT_API_KEYS[] = {
     {"key-123", "user1"},
     {"key-456", "user2"},
     {"key-789", "user3"}
 };
 
+// Published table, replaced as a whole on reload and read without a lock
+static Published<ApiKeyTable> api_keys(std::make_shared<const ApiKeyTable>());
+
+// Source of the table for reloads
+static std::mutex reload_mutex;
+static std::string keys_path;
+static RateLimit keys_default_limit;
+
+// Set once at startup, empty disables the admin endpoints
+static std::string admin_key;
+
+static Counter& missing_key_rejections = metrics().counter(
+    "wallet_auth_rejected_total", "Requests rejected before reaching a handler", {{"reason", "missing_key"}});
+static Counter& invalid_key_rejections = metrics().counter(
+    "wallet_auth_rejected_total", "Requests rejected before reaching a handler", {{"reason", "invalid_key"}});
+static Counter& rate_limited_rejections = metrics().counter(
+    "wallet_auth_rejected_total", "Requests rejected before reaching a handler", {{"reason", "rate_limited"}});
+static Counter& admin_rejections = metrics().counter(
+    "wallet_auth_rejected_total", "Requests rejected before reaching a handler", {{"reason", "admin"}});
+static Counter& key_reloads = metrics().counter(
+    "wallet_api_key_reloads_total", "API key table reloads", {{"result", "ok"}});
+static Counter& failed_key_reloads = metrics().counter(
+    "wallet_api_key_reloads_total", "API key table reloads", {{"result", "failed"}});
+
+static int64_t monotonicNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+TokenBucket::TokenBucket(RateLimit limit) : limit_(limit) {
+    interval_ns_ = static_cast<int64_t>(1e9 / limit.rate);
+    // A full bucket lets burst requests through back to back
+    tolerance_ns_ = static_cast<int64_t>(interval_ns_ * std::max(limit.burst - 1.0, 0.0));
+}
+
+bool TokenBucket::tryAcquire() {
+    int64_t now = monotonicNanos();
+    int64_t tat = tat_ns_.load(std::memory_order_relaxed);
+    for (;;) {
+        int64_t next = std::max(tat, now) + interval_ns_;
+        if (next - now > tolerance_ns_ + interval_ns_) {
+            return false;
+        }
+        if (tat_ns_.compare_exchange_weak(tat, next, std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+}
+
+static std::shared_ptr<const ApiKeyTable> currentTable() {
+    return api_keys.load();
+}
+
+// Reuse the old bucket when the limit didn't change so a reload doesn't refill it
+static std::shared_ptr<TokenBucket> bucketFor(const ApiKeyTable& old_table, const std::string& key, RateLimit limit) {
+    if (limit.rate <= 0.0) {
+        return nullptr;
+    }
+    auto it = old_table.find(key);
+    if (it != old_table.end() && it->second.bucket &&
+        it->second.bucket->limit().rate == limit.rate && it->second.bucket->limit().burst == limit.burst) {
+        return it->second.bucket;
+    }
+    return std::make_shared<TokenBucket>(limit);
+}
+
+// Whole token as a finite number, "10/s" or "abc" are rejected instead of read as 0
+static bool parseLimitValue(const std::string& token, double& value) {
+    char* end = nullptr;
+    value = std::strtod(token.c_str(), &end);
+    return end != token.c_str() && *end == '\0' && std::isfinite(value);
+}
+
+// Limits the bucket can represent: the interval and the burst's tolerance in nanoseconds must fit
+// int64_t, so tiny rates and huge bursts are refused rather than overflowing
+static bool usableLimit(const RateLimit& limit) {
+    if (limit.rate == 0.0) {
+        return true;
+    }
+    return limit.rate >= AUTH_RATE_MIN && limit.burst >= 1.0 &&
+           (limit.burst - 1.0) / limit.rate <= AUTH_BURST_WINDOW_MAX_SEC;
+}
+
+static bool buildTable(const std::string& path, RateLimit default_limit, ApiKeyTable& table) {
+    std::shared_ptr<const ApiKeyTable> old_table = currentTable();
+
+    if (!usableLimit(default_limit)) {
+        LOG_ERROR("Default rate limit %g/s burst %g is out of range", default_limit.rate, default_limit.burst);
+        return false;
+    }
+
+    if (path.empty()) {
+        for (const auto& [key, user_id] : DEFAULT_API_KEYS) {
+            table[key] = ApiKey{user_id, bucketFor(*old_table, key, default_limit)};
+        }
+        return true;
+    }
+
+    std::ifstream in(path);
+    if (!in) {
+        LOG_ERROR("Failed to open API key file %s", path.c_str());
+        return false;
+    }
+
+    std::string line;
+    size_t line_number = 0;
+    while (std::getline(in, line)) {
+        line_number++;
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) {
+            line.resize(comment);
+        }
+
+        std::istringstream fields(line);
+        std::string key;
+        std::string user_id;
+        if (!(fields >> key)) {
+            continue;
+        }
+        if (!(fields >> user_id)) {
+            LOG_ERROR("%s:%zu: missing user id", path.c_str(), line_number);
+            return false;
+        }
+
+        // Burst defaults to the rate but at least one request, as for WALLET_RATE_LIMIT_RPS
+        RateLimit limit = default_limit;
+        std::string rate;
+        std::string burst;
+        std::string extra;
+        bool valid = true;
+        if (fields >> rate) {
+            valid = parseLimitValue(rate, limit.rate);
+            limit.burst = std::max(1.0, limit.rate);
+            if (valid && fields >> burst) {
+                valid = parseLimitValue(burst, limit.burst) && !(fields >> extra);
+            }
+        }
+        if (!valid || limit.rate < 0.0 || !usableLimit(limit)) {
+            LOG_ERROR("%s:%zu: invalid rate limit", path.c_str(), line_number);
+            return false;
+        }
+        table[key] = ApiKey{user_id, bucketFor(*old_table, key, limit)};
+    }
+    return true;
+}
+
+bool loadApiKeys(const std::string& path, RateLimit default_limit) {
+    std::lock_guard<std::mutex> lock(reload_mutex);
+
+    ApiKeyTable table;
+    if (!buildTable(path, default_limit, table)) {
+        failed_key_reloads.inc();
+        return false;
+    }
+
+    keys_path = path;
+    keys_default_limit = default_limit;
+    size_t count = table.size();
+    api_keys.store(std::make_shared<const ApiKeyTable>(std::move(table)));
+    key_reloads.inc();
+    LOG_INFO("Loaded %zu API keys%s%s", count, path.empty() ? "" : " from ", path.c_str());
+    return true;
+}
+
+bool reloadApiKeys() {
+    std::string path;
+    RateLimit default_limit;
+    {
+        std::lock_guard<std::mutex> lock(reload_mutex);
+        path = keys_path;
+        default_limit = keys_default_limit;
+    }
+    return loadApiKeys(path, default_limit);
+}
+
+size_t apiKeyCount() {
+    return currentTable()->size();
+}
+
 std::string authenticateRequest(const httplib::Request& req, httplib::Response& res) {
+    TRACE_SPAN("auth");
+
     // Check if X-API-Key header exists
     if (!req.has_header("X-API-Key")) {
+        missing_key_rejections.inc();
         res.status = 401;
         json error_response;
         error_response["error"] = "Missing API key";
         error_response["message"] = "Please provide X-API-Key header";
-        res.set_content(error_response.dump(2), "application/json");
+        sendJson(req, res, error_response);
         return "";
     }
     
     std::string api_key = req.get_header_value("X-API-Key");
     
     // Check API key
-    auto iterator = VALID_API_KEYS.find(api_key);
-    if (iterator == VALID_API_KEYS.end()) {
+    std::shared_ptr<const ApiKeyTable> table = currentTable();
+    auto iterator = table->find(api_key);
+    if (iterator == table->end()) {
+        invalid_key_rejections.inc();
         res.status = 401;
         json error_response;
         error_response["error"] = "Invalid API key";
-        error_response["message"] = "Valid keys: key-123, key-456, key-789";
-        res.set_content(error_response.dump(2), "application/json");
+        error_response["message"] = "Please provide a valid X-API-Key header";
+        sendJson(req, res, error_response);
+        return "";
+    }
+
+    // Over the limit: answer before the handler parses the body or touches the database
+    const ApiKey& key = iterator->second;
+    if (key.bucket && !key.bucket->tryAcquire()) {
+        rate_limited_rejections.inc();
+        res.status = 429;
+        res.set_header("Retry-After", std::to_string(AUTH_RETRY_AFTER_SEC));
+        json error_response;
+        error_response["error"] = "Too many requests";
+        error_response["message"] = "Rate limit for this API key exceeded";
+        sendJson(req, res, error_response);
         return "";
     }
     
     // Return user_id corresponding to the API key
-    return iterator->second;
-}
\ No newline at end of file
+    return key.user_id;
+}
+
+void setAdminKey(const std::string& key) {
+    admin_key = key;
+}
+
+bool authenticateAdmin(const httplib::Request& req, httplib::Response& res) {
+    if (admin_key.empty()) {
+        admin_rejections.inc();
+        res.status = 403;
+        json error_response;
+        error_response["error"] = "Admin API disabled";
+        error_response["message"] = "Set WALLET_ADMIN_KEY to enable it";
+        sendJson(req, res, error_response);
+        return false;
+    }
+
+    // Compare every byte so the time taken doesn't reveal how much of the key matched
+    std::string provided = req.get_header_value("X-Admin-Key");
+    unsigned char diff = provided.size() == admin_key.size() ? 0 : 1;
+    for (size_t i = 0; i < provided.size() && i < admin_key.size(); i++) {
+        diff |= static_cast<unsigned char>(provided[i] ^ admin_key[i]);
+    }
+    if (diff != 0) {
+        admin_rejections.inc();
+        res.status = 401;
+        json error_response;
+        error_response["error"] = "Invalid admin key";
+        error_response["message"] = "Please provide a valid X-Admin-Key header";
+        sendJson(req, res, error_response);
+        return false;
+    }
+    return true;
+}
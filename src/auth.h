@@ -2,10 +2,69 @@
 #define AUTH_H
 
 #include <string>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <unordered_map>
 #include "../third_party/httplib.h"
 
+#define AUTH_RETRY_AFTER_SEC    1
+#define AUTH_RATE_MIN           (1.0 / 86400)       // slowest limit accepted, one request a day
+#define AUTH_BURST_WINDOW_MAX_SEC (365.0 * 86400)   // longest time a full bucket may take to earn
+
+// Per-key request budget: rate per second and how many requests may arrive at once
+// rate 0 disables the limit. Others must be at least AUTH_RATE_MIN with a burst the bucket can
+// hold in int64_t nanoseconds, loadApiKeys() rejects the rest
+struct RateLimit {
+    double rate = 0.0;
+    double burst = 0.0;
+};
+
+// Lock-free token bucket, kept as a theoretical arrival time (GCRA) in one atomic
+class TokenBucket {
+public:
+    explicit TokenBucket(RateLimit limit);
+
+    // Take one token, false if the key is over its limit
+    bool tryAcquire();
+
+    const RateLimit& limit() const { return limit_; }
+
+private:
+    RateLimit limit_;
+    int64_t interval_ns_;           // time to earn one token
+    int64_t tolerance_ns_;          // how far ahead of now the arrival time may run (burst)
+    std::atomic<int64_t> tat_ns_{0};
+};
+
+// API key owner and its bucket, the bucket is carried over on reload if the limit is unchanged
+struct ApiKey {
+    std::string user_id;
+    std::shared_ptr<TokenBucket> bucket;    // nullptr if unlimited
+};
+
+// Read-only snapshot of all API keys, replaced as a whole on reload
+using ApiKeyTable = std::unordered_map<std::string, ApiKey>;
+
+// Load keys from a file, one "<key> <user_id> [rate [burst]]" per line, # starts a comment
+// Empty path installs the built-in demo keys. Keys without their own limit get default_limit.
+// Returns false and keeps the current table if the file can't be read
+bool loadApiKeys(const std::string& path, RateLimit default_limit);
+
+// Reload from the same source as the last loadApiKeys(), e.g. on SIGHUP
+bool reloadApiKeys();
+
+// Number of keys in the current table
+size_t apiKeyCount();
+
 // Authenticate request and return user_id
-// Returns empty string if authentication fails
+// Returns empty string if authentication fails (401) or the key is over its rate limit (429)
 std::string authenticateRequest(const httplib::Request& req, httplib::Response& res);
 
-#endif
\ No newline at end of file
+// Key for the /admin endpoints, empty (the default) disables them
+void setAdminKey(const std::string& key);
+
+// Check the X-Admin-Key header, answers 403 if admin endpoints are disabled and 401 for a wrong key
+bool authenticateAdmin(const httplib::Request& req, httplib::Response& res);
+
+#endif
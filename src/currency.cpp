@@ -0,0 +1,151 @@
+#include "currency.h"
+#include <algorithm>
+#include <cstring>
+
+CurrencyCode CurrencyCode::fromChars(const char* code, size_t length) {
+    if (length != 3) {
+        return CurrencyCode();
+    }
+
+    uint16_t value = 0;
+    for (size_t i = 0; i < 3; i++) {
+        char c = code[i];
+        // In case it is not uppercase, convert
+        if (c >= 'a' && c <= 'z') {
+            c = static_cast<char>(c - 'a' + 'A');
+        }
+        if (c < 'A' || c > 'Z') {
+            return CurrencyCode();
+        }
+        value = static_cast<uint16_t>((value << 5) | (c - 'A' + 1));
+    }
+    return CurrencyCode(value);
+}
+
+CurrencyCode CurrencyCode::fromString(const std::string& code) {
+    return fromChars(code.data(), code.size());
+}
+
+std::string CurrencyCode::str() const {
+    if (!valid()) {
+        return std::string();
+    }
+    char letters[3] = {
+        static_cast<char>('A' - 1 + ((value_ >> 10) & 0x1F)),
+        static_cast<char>('A' - 1 + ((value_ >> 5) & 0x1F)),
+        static_cast<char>('A' - 1 + (value_ & 0x1F)),
+    };
+    return std::string(letters, 3);
+}
+
+RateTable::RateTable() : rates_(new double[CurrencyCode::kCount]()) {}
+
+void RateTable::set(CurrencyCode code, double rate) {
+    if (!code.valid() || rate <= 0.0) {
+        return;
+    }
+    if (!has(code)) {
+        codes_.push_back(code);
+    }
+    rates_[code.index()] = rate;
+}
+
+Balances::Balances(const Balances& other) {
+    *this = other;
+}
+
+Balances& Balances::operator=(const Balances& other) {
+    if (this == &other) {
+        return *this;
+    }
+    if (other.size_ > BALANCES_INLINE_CAPACITY) {
+        heap_.reset(new Entry[other.capacity_]);
+        capacity_ = other.capacity_;
+    } else {
+        heap_.reset();
+        capacity_ = BALANCES_INLINE_CAPACITY;
+    }
+    std::copy(other.begin(), other.end(), data());
+    size_ = other.size_;
+    return *this;
+}
+
+Balances::Balances(Balances&& other) noexcept {
+    *this = std::move(other);
+}
+
+Balances& Balances::operator=(Balances&& other) noexcept {
+    if (this == &other) {
+        return *this;
+    }
+    heap_ = std::move(other.heap_);
+    capacity_ = other.capacity_;
+    size_ = other.size_;
+    if (!heap_) {
+        std::copy(other.inline_, other.inline_ + size_, inline_);
+    }
+    other.size_ = 0;
+    other.capacity_ = BALANCES_INLINE_CAPACITY;
+    return *this;
+}
+
+size_t Balances::lowerBound(CurrencyCode code) const {
+    // Wallets are small, a linear scan beats binary search here
+    const Entry* entries = data();
+    size_t i = 0;
+    while (i < size_ && entries[i].code < code) {
+        i++;
+    }
+    return i;
+}
+
+double* Balances::find(CurrencyCode code) {
+    size_t i = lowerBound(code);
+    if (i < size_ && data()[i].code == code) {
+        return &data()[i].amount;
+    }
+    return nullptr;
+}
+
+const double* Balances::find(CurrencyCode code) const {
+    size_t i = lowerBound(code);
+    if (i < size_ && data()[i].code == code) {
+        return &data()[i].amount;
+    }
+    return nullptr;
+}
+
+double& Balances::operator[](CurrencyCode code) {
+    size_t i = lowerBound(code);
+    if (i < size_ && data()[i].code == code) {
+        return data()[i].amount;
+    }
+
+    if (size_ == capacity_) {
+        grow();
+    }
+    Entry* entries = data();
+    std::move_backward(entries + i, entries + size_, entries + size_ + 1);
+    entries[i] = Entry{code, 0.0};
+    size_++;
+    return entries[i].amount;
+}
+
+bool Balances::erase(CurrencyCode code) {
+    size_t i = lowerBound(code);
+    if (i >= size_ || data()[i].code != code) {
+        return false;
+    }
+    Entry* entries = data();
+    std::move(entries + i + 1, entries + size_, entries + i);
+    size_--;
+    return true;
+}
+
+void Balances::grow() {
+    uint32_t new_capacity = capacity_ * 2;
+    std::unique_ptr<Entry[]> bigger(new Entry[new_capacity]);
+    std::copy(data(), data() + size_, bigger.get());
+    heap_ = std::move(bigger);
+    capacity_ = new_capacity;
+}
@@ -0,0 +1,105 @@
+#ifndef CURRENCY_H
+#define CURRENCY_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+#define BALANCES_INLINE_CAPACITY 8
+
+// ISO 4217 code packed into 15 bits, 5 bits per letter (A=1 ... Z=26)
+// Packed values sort in the same order as the strings, 0 means invalid
+class CurrencyCode {
+public:
+    static constexpr size_t kCount = 1 << 15;
+
+    constexpr CurrencyCode() : value_(0) {}
+
+    // Parse a 3-letter code, lowercase is accepted. Returns invalid code otherwise
+    static CurrencyCode fromString(const std::string& code);
+    static CurrencyCode fromChars(const char* code, size_t length);
+
+    bool valid() const { return value_ != 0; }
+    uint16_t index() const { return value_; }
+
+    std::string str() const;
+
+    bool operator==(CurrencyCode other) const { return value_ == other.value_; }
+    bool operator!=(CurrencyCode other) const { return value_ != other.value_; }
+    bool operator<(CurrencyCode other) const { return value_ < other.value_; }
+
+private:
+    explicit constexpr CurrencyCode(uint16_t value) : value_(value) {}
+
+    uint16_t value_;
+};
+
+// Dense rate array indexed by CurrencyCode, 0 means no rate
+class RateTable {
+public:
+    RateTable();
+
+    void set(CurrencyCode code, double rate);
+
+    double get(CurrencyCode code) const { return rates_[code.index()]; }
+    bool has(CurrencyCode code) const { return rates_[code.index()] > 0.0; }
+
+    // Codes that have a rate, in insertion order
+    const std::vector<CurrencyCode>& codes() const { return codes_; }
+    size_t size() const { return codes_.size(); }
+    bool empty() const { return codes_.empty(); }
+
+private:
+    std::unique_ptr<double[]> rates_;
+    std::vector<CurrencyCode> codes_;
+};
+
+// Balances of one wallet as (code, amount) pairs sorted by code
+// The first BALANCES_INLINE_CAPACITY entries live inline, no allocation for typical wallets
+class Balances {
+public:
+    struct Entry {
+        CurrencyCode code;
+        double amount;
+    };
+
+    Balances() = default;
+    Balances(const Balances& other);
+    Balances& operator=(const Balances& other);
+    Balances(Balances&& other) noexcept;
+    Balances& operator=(Balances&& other) noexcept;
+    ~Balances() = default;
+
+    // Pointer to the amount, nullptr if the currency is not in the wallet
+    double* find(CurrencyCode code);
+    const double* find(CurrencyCode code) const;
+
+    // Reference to the amount, inserted as 0 if missing
+    double& operator[](CurrencyCode code);
+
+    bool erase(CurrencyCode code);
+    void clear() { size_ = 0; }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    const Entry* begin() const { return data(); }
+    const Entry* end() const { return data() + size_; }
+
+private:
+    Entry* data() { return heap_ ? heap_.get() : inline_; }
+    const Entry* data() const { return heap_ ? heap_.get() : inline_; }
+
+    // Index of the first entry with code >= the given one
+    size_t lowerBound(CurrencyCode code) const;
+    void grow();
+
+    Entry inline_[BALANCES_INLINE_CAPACITY];
+    std::unique_ptr<Entry[]> heap_;
+    uint32_t size_ = 0;
+    uint32_t capacity_ = BALANCES_INLINE_CAPACITY;
+};
+
+#endif // CURRENCY_H
@@ -1,164 +1,144 @@
 #include "database.h"
-#include <sqlite3.h>
-#include <iostream>
+#include <memory>
+#include <mutex>
+#include "sqlite_storage.h"
+#include "journal_storage.h"
+#include "logger.h"
+#include "metrics.h"
+#include "tracing.h"
 
-const std::string DB_PATH = "data/wallet.db";
+static std::string db_path = DB_DEFAULT_PATH;
+static std::string engine_name = DB_DEFAULT_ENGINE;
+static size_t batch_max_size = DB_BATCH_MAX_SIZE;
+static int batch_max_wait_ms = DB_BATCH_MAX_WAIT_MS;
+static size_t journal_compact_bytes = static_cast<size_t>(DB_JOURNAL_COMPACT_MB) << 20;
 
-bool initDatabase() {
-    sqlite3* db;
-    char* errMsg = nullptr;
+static std::unique_ptr<StorageEngine> engine;
 
-    // Open database (create if not exist)
-    int rc = sqlite3_open(DB_PATH.c_str(), &db);
-    if (rc != SQLITE_OK) {
-        std::cerr << "Failed to open database: " << sqlite3_errmsg(db) << std::endl;
-        return false;
-    }
+// Open engine when it is the SQLite one, read by metrics scrapes on other threads
+// Cleared under the mutex before the engine closes, the statistics getters hold it for the whole call
+static std::mutex stats_mutex;
+static SQLiteStorage* sqlite_engine = nullptr;
 
-    // Create SQL table
-    const char* sql = 
-        "CREATE TABLE IF NOT EXISTS wallet ("
-        "    user_id TEXT NOT NULL,"
-        "    currency_code TEXT NOT NULL,"
-        "    amount REAL NOT NULL,"
-        "    PRIMARY KEY (user_id, currency_code)"
-        ");";
-        
-    // Execute SQL
-    rc = sqlite3_exec(db, sql, nullptr, nullptr, &errMsg);
-    if (rc != SQLITE_OK) {
-        std::cerr << "SQL error: " << errMsg << std::endl;
-        sqlite3_free(errMsg);
-        sqlite3_close(db);
+bool setStorageEngine(const std::string& name) {
+    if (name != "sqlite" && name != "journal") {
         return false;
     }
-    
-    sqlite3_close(db);
-
-    std::cout << "Database initialized successfully" << std::endl;
+    engine_name = name;
     return true;
 }
 
-bool loadWalletFromDB(const std::string& user_id, std::map<std::string, double>& wallet) {
-    sqlite3* db;
-    sqlite3_stmt* stmt;
-    
-    // Open database
-    int rc = sqlite3_open(DB_PATH.c_str(), &db);
-    if (rc != SQLITE_OK) {
-        std::cerr << "Failed to open database: " << sqlite3_errmsg(db) << std::endl;
-        return false;
+void setDatabasePath(const std::string& path) {
+    db_path = path;
+}
+
+void setGroupCommitConfig(size_t max_batch_size, int max_wait_ms) {
+    batch_max_size = max_batch_size;
+    batch_max_wait_ms = max_wait_ms;
+}
+
+void setJournalCompactSize(size_t bytes) {
+    journal_compact_bytes = bytes;
+}
+
+bool initDatabase() {
+    if (engine_name == "journal") {
+        engine = std::make_unique<JournalStorage>(db_path + ".journal", journal_compact_bytes);
+    } else {
+        engine = std::make_unique<SQLiteStorage>(db_path, batch_max_size, batch_max_wait_ms);
+
+        // Registered once, reads whichever engine is open at scrape time
+        static std::once_flag gauge_registered;
+        std::call_once(gauge_registered, [] {
+            metrics().callbackGauge("wallet_db_pool_available", "Idle pooled SQLite connections",
+                                    [] { return static_cast<double>(getDBPoolStats().available); });
+        });
     }
-    
-    // Prepare SELECT query
-    const char* sql = "SELECT currency_code, amount FROM wallet WHERE user_id = ?";
-    rc = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
-    if (rc != SQLITE_OK) {
-        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db) << std::endl;
-        sqlite3_close(db);
+    LOG_INFO("Storage engine: %s", engine_name.c_str());
+
+    if (!engine->open()) {
+        closeDatabase();
         return false;
     }
-    
-    // Add user_id
-    sqlite3_bind_text(stmt, 1, user_id.c_str(), -1, SQLITE_TRANSIENT);
-
-    wallet.clear();
-    
-    // Go through results
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        std::string currency = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
-        double amount = sqlite3_column_double(stmt, 1);
-        wallet[currency] = amount;
-        std::cout << "Loaded for " << user_id << ": " << currency << " = " << amount << std::endl;
-    }
-    
-    // Clean
-    sqlite3_finalize(stmt);
-    sqlite3_close(db);
-    
-    std::cout << "Loaded " << wallet.size() << " currencies for user " << user_id << std::endl;
+
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    sqlite_engine = dynamic_cast<SQLiteStorage*>(engine.get());
     return true;
 }
 
-bool saveCurrencyToDB(const std::string& user_id, const std::string& currency, double amount) {
-    sqlite3* db;
-    sqlite3_stmt* stmt;
-    
-    // Open database
-    int rc = sqlite3_open(DB_PATH.c_str(), &db);
-    if (rc != SQLITE_OK) {
-        std::cerr << "Failed to open database: " << sqlite3_errmsg(db) << std::endl;
-        return false;
-    }
-    
-    // Prepare query
-    const char* sql = "REPLACE INTO wallet (user_id, currency_code, amount) VALUES (?, ?, ?)";
-    rc = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
-    if (rc != SQLITE_OK) {
-        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db) << std::endl;
-        sqlite3_close(db);
-        return false;
+void closeDatabase() {
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        sqlite_engine = nullptr;
     }
-    
-    // Add parameters
-    sqlite3_bind_text(stmt, 1, user_id.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 2, currency.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_double(stmt, 3, amount);
-    
-    // Execute
-    rc = sqlite3_step(stmt);
-    if (rc != SQLITE_DONE) {
-        std::cerr << "Failed to execute: " << sqlite3_errmsg(db) << std::endl;
-        sqlite3_finalize(stmt);
-        sqlite3_close(db);
-        return false;
+    if (engine) {
+        engine->close();
+        engine.reset();
     }
-    
-    // Clean
-    sqlite3_finalize(stmt);
-    sqlite3_close(db);
+}
 
-    std::cout << "Saved to DB for " << user_id << ": " << currency << " = " << amount << std::endl;
-    return true;
+bool loadWalletFromDB(const std::string& user_id, Balances& wallet) {
+    TRACE_SPAN("db.load_wallet");
+    int64_t version = 0;
+    return engine->loadWallet(user_id, wallet, version);
+}
+
+bool loadWalletFromDB(const std::string& user_id, Balances& wallet, int64_t& version) {
+    TRACE_SPAN("db.load_wallet");
+    return engine->loadWallet(user_id, wallet, version);
+}
+
+bool loadAllWalletsFromDB(const WalletScanFn& fn) {
+    TRACE_SPAN("db.load_all_wallets");
+    return engine->loadAllWallets(fn);
+}
+
+bool loadCurrencyTotalsFromDB(const CurrencyTotalsFn& fn, int64_t& version) {
+    TRACE_SPAN("db.load_currency_totals");
+    return engine->loadCurrencyTotals(fn, version);
+}
+
+bool saveCurrencyToDB(const std::string& user_id, const std::string& currency, double amount) {
+    TRACE_SPAN("db.commit");
+    int64_t version = 0;
+    return engine->commit("", -1, {DBMutation{user_id, currency, amount, false}}, version) == DBWriteResult::Ok;
 }
 
 bool deleteCurrencyFromDB(const std::string& user_id, const std::string& currency) {
-    sqlite3* db;
-    sqlite3_stmt* stmt;
-    
-    // Open database
-    int rc = sqlite3_open(DB_PATH.c_str(), &db);
-    if (rc != SQLITE_OK) {
-        std::cerr << "Failed to open database: " << sqlite3_errmsg(db) << std::endl;
-        return false;
-    }
-    
-    // Prepare DELETE query
-    const char* sql = "DELETE FROM wallet WHERE user_id = ? AND currency_code = ?";
-    rc = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
-    if (rc != SQLITE_OK) {
-        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db) << std::endl;
-        sqlite3_close(db);
-        return false;
-    }
-    
-    // Add parameter
-    sqlite3_bind_text(stmt, 1, user_id.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 2, currency.c_str(), -1, SQLITE_TRANSIENT);
-    
-    // Execute
-    rc = sqlite3_step(stmt);
-    if (rc != SQLITE_DONE) {
-        std::cerr << "Failed to execute: " << sqlite3_errmsg(db) << std::endl;
-        sqlite3_finalize(stmt);
-        sqlite3_close(db);
-        return false;
+    TRACE_SPAN("db.commit");
+    int64_t version = 0;
+    return engine->commit("", -1, {DBMutation{user_id, currency, 0.0, true}}, version) == DBWriteResult::Ok;
+}
+
+bool commitMutationsToDB(const std::vector<DBMutation>& mutations) {
+    TRACE_SPAN("db.commit");
+    if (mutations.empty()) {
+        return true;
     }
-    
-    // Clean
-    sqlite3_finalize(stmt);
-    sqlite3_close(db);
+    int64_t version = 0;
+    return engine->commit("", -1, mutations, version) == DBWriteResult::Ok;
+}
 
-    std::cout << "Deleted from DB for " << user_id << ": " << currency << std::endl;
-    return true;
-}
\ No newline at end of file
+DBWriteResult commitWalletToDB(const std::string& user_id, int64_t expected_version,
+                               const std::vector<DBMutation>& mutations, int64_t& new_version) {
+    TRACE_SPAN("db.commit");
+    return engine->commit(user_id, expected_version, mutations, new_version);
+}
+
+int64_t latestVersionInDB() {
+    return engine->latestVersion();
+}
+
+bool startChangeFeed(int64_t since_version, int interval_ms, DBChangeCallback on_change) {
+    return engine->startChangeFeed(since_version, interval_ms, std::move(on_change));
+}
+
+DBPoolStats getDBPoolStats() {
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    return sqlite_engine ? sqlite_engine->poolStats() : DBPoolStats{};
+}
+
+DBCommitStats getDBCommitStats() {
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    return sqlite_engine ? sqlite_engine->commitStats() : DBCommitStats{};
+}
@@ -2,13 +2,76 @@
 #define DATABASE_H
 
 #include <string>
-#include <map>
+#include <vector>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
+#include "currency.h"
+#include "storage.h"
 
-// Initialize database and create wallet table
+#define DB_DEFAULT_PATH         "data/wallet.db"
+#define DB_DEFAULT_ENGINE       "sqlite"
+#define DB_JOURNAL_COMPACT_MB   64      // journal log size that triggers a snapshot
+#define DB_POOL_SIZE            4
+#define DB_POOL_SLOW_WAIT_MS    100
+#define DB_BATCH_MAX_SIZE       256     // mutations per group commit
+#define DB_BATCH_MAX_WAIT_MS    2       // how long the writer waits for a batch to fill up
+#define DB_SYNC_INTERVAL_MS     250     // how often commits by other processes are looked for without a poke
+#define DB_DELTA_RETAIN         100000  // versions whose totals deltas are kept for processes catching up
+#define DB_DELTA_PRUNE_BATCHES  256     // group commits between prunes of older deltas
+
+// Connection pool statistics
+struct DBPoolStats {
+    size_t pool_size;
+    size_t available;
+    uint64_t checkouts;
+    uint64_t contended_checkouts;   // checkouts that had to wait for a free connection
+    double total_wait_ms;
+    double max_wait_ms;
+};
+
+// Group commit statistics
+struct DBCommitStats {
+    uint64_t batches;
+    uint64_t mutations;
+    uint64_t failed_batches;
+    size_t max_batch_size;
+    double total_commit_ms;
+};
+
+// The functions below go to the storage engine chosen here:
+//   "sqlite"   wallet table in the SQLite file at the database path (default)
+//   "journal"  append-only memory-mapped log with snapshots in <database path>.journal/, one process only
+// Must be set before initDatabase(), returns false for an unknown engine
+bool setStorageEngine(const std::string& name);
+
+// Database file location, must be set before initDatabase()
+void setDatabasePath(const std::string& path);
+
+// Group commit limits of the SQLite engine, must be set before initDatabase()
+void setGroupCommitConfig(size_t max_batch_size, int max_wait_ms);
+
+// Journal size that makes the journal engine write a snapshot and start a new log, must be set before initDatabase()
+void setJournalCompactSize(size_t bytes);
+
+// Open the selected storage engine: create the wallet table or replay the journal, start the writer
 bool initDatabase();
 
+// Flush pending writes, stop the writer and close the storage engine
+void closeDatabase();
+
 // Load wallet from database
-bool loadWalletFromDB(const std::string& user_id, std::map<std::string, double>& wallet);
+bool loadWalletFromDB(const std::string& user_id, Balances& wallet);
+
+// Load wallet and its version (0 if it was never written) from one snapshot
+bool loadWalletFromDB(const std::string& user_id, Balances& wallet, int64_t& version);
+
+// Read every wallet in one sequential scan of the table, calls fn once per user
+bool loadAllWalletsFromDB(const WalletScanFn& fn);
+
+// Sum and number of holders of every currency, aggregated by the database, calls fn once per currency
+// version is the latest wallet version the totals include, a change feed started there misses nothing
+bool loadCurrencyTotalsFromDB(const CurrencyTotalsFn& fn, int64_t& version);
 
 // Save a currency to database
 bool saveCurrencyToDB(const std::string& user_id, const std::string& currency, double amount);
@@ -16,6 +79,29 @@ bool saveCurrencyToDB(const std::string& user_id, const std::string& currency, d
 // Delete a currency from database
 bool deleteCurrencyFromDB(const std::string& user_id, const std::string& currency);
 
+// Apply mutations in a single transaction, returns once the transaction is durable
+bool commitMutationsToDB(const std::vector<DBMutation>& mutations);
+
+// Apply one user's mutations through the group commit, only if the user's version is still expected_version
+// On success new_version is the version the wallet has now
+// Every write, versioned or not, gives the users it touches a new version
+DBWriteResult commitWalletToDB(const std::string& user_id, int64_t expected_version,
+                               const std::vector<DBMutation>& mutations, int64_t& new_version);
+
+// Highest wallet version in the database, where a change feed should start
+int64_t latestVersionInDB();
+
+// Report every wallet another process wrote after since_version and how the totals changed, on a background thread
+// Polls every interval_ms, and right away when another process pokes this one after a commit
+// Stopped by closeDatabase()
+bool startChangeFeed(int64_t since_version, int interval_ms, DBChangeCallback on_change);
+
+// Snapshot of connection pool wait times (SQLite engine)
+DBPoolStats getDBPoolStats();
+
+// Snapshot of group commit batch sizes and commit times (SQLite engine)
+DBCommitStats getDBCommitStats();
+
 void testDatabaseOperations();
 
-#endif // DATABASE_H
\ No newline at end of file
+#endif // DATABASE_H
@@ -0,0 +1,147 @@
+#include "exposure.h"
+#include <algorithm>
+
+ExposureTracker::ExposureTracker()
+    : slots_(new Slot[CurrencyCode::kCount]), listed_(new std::atomic<bool>[CurrencyCode::kCount]) {
+    for (size_t i = 0; i < CurrencyCode::kCount; i++) {
+        listed_[i].store(false, std::memory_order_relaxed);
+    }
+}
+
+void ExposureTracker::add(CurrencyCode code, double amount, int64_t holders) {
+    if (!listed_[code.index()].load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(codes_mutex_);
+        if (!listed_[code.index()].load(std::memory_order_relaxed)) {
+            codes_.push_back(code);
+            listed_[code.index()].store(true, std::memory_order_release);
+        }
+    }
+
+    Slot& slot = slots_[code.index()];
+    double current = slot.amount.load(std::memory_order_relaxed);
+    while (!slot.amount.compare_exchange_weak(current, current + amount, std::memory_order_relaxed)) {
+    }
+    if (holders != 0) {
+        slot.holders.fetch_add(holders, std::memory_order_relaxed);
+    }
+}
+
+void ExposureTracker::apply(const Balances& before, const Balances& after, int64_t version) {
+    // Both sides are sorted by code, walk them like a merge
+    std::vector<Change> changes;
+    const Balances::Entry* old_entry = before.begin();
+    const Balances::Entry* new_entry = after.begin();
+    while (old_entry != before.end() || new_entry != after.end()) {
+        if (new_entry == after.end() || (old_entry != before.end() && old_entry->code < new_entry->code)) {
+            changes.push_back({version, old_entry->code, -old_entry->amount, -1});
+            ++old_entry;
+        } else if (old_entry == before.end() || new_entry->code < old_entry->code) {
+            changes.push_back({version, new_entry->code, new_entry->amount, 1});
+            ++new_entry;
+        } else {
+            if (new_entry->amount != old_entry->amount) {
+                changes.push_back({version, new_entry->code, new_entry->amount - old_entry->amount, 0});
+            }
+            ++old_entry;
+            ++new_entry;
+        }
+    }
+    applyChanges(changes.data(), changes.size());
+}
+
+void ExposureTracker::apply(const DBTotalsDelta& delta) {
+    Change change{delta.version, delta.code, delta.amount, delta.holders};
+    applyChanges(&change, 1);
+}
+
+void ExposureTracker::applyChanges(const Change* changes, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    { std::lock_guard<std::mutex> gate(rebuild_gate_); }
+    std::shared_lock<std::shared_mutex> lock(rebuild_mutex_);
+
+    // Changes of one call come from one commit, loaded totals may include it already
+    if (changes[0].version <= loaded_version_.load(std::memory_order_relaxed)) {
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        add(changes[i].code, changes[i].amount, changes[i].holders);
+    }
+    if (recording_.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> recorded_lock(recorded_mutex_);
+        recorded_.insert(recorded_.end(), changes, changes + count);
+    }
+}
+
+void ExposureTracker::resetLocked(const std::vector<CurrencyExposure>& totals) {
+    {
+        std::lock_guard<std::mutex> lock(codes_mutex_);
+        for (CurrencyCode code : codes_) {
+            slots_[code.index()].amount.store(0.0, std::memory_order_relaxed);
+            slots_[code.index()].holders.store(0, std::memory_order_relaxed);
+        }
+    }
+    for (const CurrencyExposure& total : totals) {
+        add(total.code, total.amount, total.holders);
+    }
+}
+
+void ExposureTracker::reset(const std::vector<CurrencyExposure>& totals, int64_t version) {
+    resetLocked(totals);
+    loaded_version_.store(version, std::memory_order_relaxed);
+}
+
+bool ExposureTracker::rebuild(const Loader& loader) {
+    // Changes from here on are recorded. Earlier ones were committed before loading starts, so it includes them
+    {
+        std::lock_guard<std::mutex> gate(rebuild_gate_);
+        std::unique_lock<std::shared_mutex> lock(rebuild_mutex_);
+        recording_.store(true, std::memory_order_relaxed);
+    }
+
+    std::vector<CurrencyExposure> totals;
+    int64_t version = 0;
+    bool loaded = loader(totals, version);
+
+    std::lock_guard<std::mutex> gate(rebuild_gate_);
+    std::unique_lock<std::shared_mutex> lock(rebuild_mutex_);
+    std::lock_guard<std::mutex> recorded_lock(recorded_mutex_);
+    if (loaded) {
+        // Recorded changes the load didn't see yet are wiped by the reset, apply them again
+        resetLocked(totals);
+        for (const Change& change : recorded_) {
+            if (change.version > version) {
+                add(change.code, change.amount, change.holders);
+            }
+        }
+        loaded_version_.store(std::max(version, loaded_version_.load(std::memory_order_relaxed)),
+                              std::memory_order_relaxed);
+    }
+    recording_.store(false, std::memory_order_relaxed);
+    recorded_.clear();
+    return loaded;
+}
+
+std::vector<CurrencyExposure> ExposureTracker::totals() const {
+    std::vector<CurrencyCode> codes;
+    {
+        std::lock_guard<std::mutex> lock(codes_mutex_);
+        codes = codes_;
+    }
+
+    std::vector<CurrencyExposure> result;
+    for (CurrencyCode code : codes) {
+        const Slot& slot = slots_[code.index()];
+        int64_t holders = slot.holders.load(std::memory_order_relaxed);
+        if (holders > 0) {
+            result.push_back({code, slot.amount.load(std::memory_order_relaxed), holders});
+        }
+    }
+    return result;
+}
+
+ExposureTracker& exposure() {
+    static ExposureTracker tracker;
+    return tracker;
+}
@@ -0,0 +1,79 @@
+#ifndef EXPOSURE_H
+#define EXPOSURE_H
+
+#include <vector>
+#include <mutex>
+#include <shared_mutex>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include "currency.h"
+#include "storage.h"
+
+// Holdings of one currency summed over all users
+struct CurrencyExposure {
+    CurrencyCode code;
+    double amount;
+    int64_t holders;    // wallets with a non-zero balance
+};
+
+// Running per-currency totals over every wallet, resident or not
+// Updated from each committed wallet change, ours and other processes', read without locks
+// Every change carries the wallet version it committed, so one already included in loaded totals is skipped
+class ExposureTracker {
+public:
+    using Loader = std::function<bool(std::vector<CurrencyExposure>& totals, int64_t& version)>;
+
+    ExposureTracker();
+
+    // Account for one wallet changing from before to after (both sorted by code), committed as version
+    void apply(const Balances& before, const Balances& after, int64_t version);
+
+    // Account for another process's commit
+    void apply(const DBTotalsDelta& delta);
+
+    // Replace all totals, e.g. with the ones aggregated by the database at startup
+    // version is the latest change they include. Not safe against concurrent apply(), call before serving requests
+    void reset(const std::vector<CurrencyExposure>& totals, int64_t version);
+
+    // Replace all totals with the ones loader aggregates, safe while serving
+    // Changes are only held up while the loaded totals are swapped in, not while loading
+    // Used when the deltas of other processes' commits are no longer available
+    bool rebuild(const Loader& loader);
+
+    // Currencies that are held by at least one wallet
+    std::vector<CurrencyExposure> totals() const;
+
+private:
+    struct Slot {
+        std::atomic<double> amount{0.0};
+        std::atomic<int64_t> holders{0};
+    };
+
+    struct Change {
+        int64_t version;
+        CurrencyCode code;
+        double amount;
+        int64_t holders;
+    };
+
+    void add(CurrencyCode code, double amount, int64_t holders);
+    void applyChanges(const Change* changes, size_t count);
+    void resetLocked(const std::vector<CurrencyExposure>& totals);
+
+    std::unique_ptr<Slot[]> slots_;         // indexed by CurrencyCode
+    mutable std::mutex codes_mutex_;
+    std::vector<CurrencyCode> codes_;       // every code ever touched, so reads stay O(currencies)
+    std::unique_ptr<std::atomic<bool>[]> listed_;
+    std::shared_mutex rebuild_mutex_;       // shared while applying a change, exclusive while swapping in totals
+    std::mutex rebuild_gate_;               // a waiting rebuild holds it so a stream of writers can't starve it
+    std::atomic<int64_t> loaded_version_{0};   // changes up to here are part of the loaded totals
+    std::atomic<bool> recording_{false};    // a rebuild is loading, changes must be kept for it
+    std::mutex recorded_mutex_;
+    std::vector<Change> recorded_;          // changes applied while the rebuild loaded
+};
+
+ExposureTracker& exposure();
+
+#endif // EXPOSURE_H
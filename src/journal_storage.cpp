@@ -0,0 +1,608 @@
+#include "journal_storage.h"
+#include <algorithm>
+#include <map>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "logger.h"
+#include "metrics.h"
+
+static const char JOURNAL_MAGIC[4] = {'W', 'J', 'L', '1'};
+
+static Histogram& journal_sync_seconds = metrics().histogram(
+    "wallet_journal_sync_seconds", "fdatasync of the journal log, one per group of commits");
+static Counter& journal_records = metrics().counter(
+    "wallet_journal_records_total", "Records appended to the journal log");
+static Counter& journal_syncs = metrics().counter(
+    "wallet_journal_syncs_total", "Journal log syncs, each one makes every commit appended before it durable");
+static Counter& journal_conflicts = metrics().counter(
+    "wallet_journal_version_conflicts_total", "Journal writes refused because the wallet changed since it was read");
+static Counter& journal_compactions_ok = metrics().counter(
+    "wallet_journal_compactions_total", "Journal snapshots written", {{"result", "ok"}});
+static Counter& journal_compactions_failed = metrics().counter(
+    "wallet_journal_compactions_total", "Journal snapshots written", {{"result", "failed"}});
+static Gauge& journal_log_bytes = metrics().gauge(
+    "wallet_journal_log_bytes", "Bytes in the current journal log");
+
+static uint32_t recordChecksum(const JournalRecord& record) {
+    const Bytef* bytes = reinterpret_cast<const Bytef*>(&record) + sizeof(record.checksum);
+    return static_cast<uint32_t>(crc32(0L, bytes, sizeof(record) - sizeof(record.checksum)));
+}
+
+static JournalRecord makeRecord(JournalRecordType type, const std::string& user_id, int64_t version,
+                                const char* currency, double amount) {
+    JournalRecord record;
+    memset(&record, 0, sizeof(record));
+    record.type = type;
+    record.user_length = static_cast<uint8_t>(user_id.size());
+    record.version = version;
+    record.amount = amount;
+    memcpy(record.currency, currency, sizeof(record.currency));
+    memcpy(record.user_id, user_id.data(), user_id.size());
+    return record;
+}
+
+// Checksum goes in last, once every other field is final
+static void seal(JournalRecord& record) {
+    record.checksum = recordChecksum(record);
+}
+
+static bool isValid(const JournalRecord& record) {
+    return record.type >= JOURNAL_HEADER && record.type <= JOURNAL_REMOVE &&
+           record.user_length <= JOURNAL_USER_ID_MAX && record.checksum == recordChecksum(record);
+}
+
+static bool syncDirectory(const std::string& dir) {
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+}
+
+JournalStorage::JournalStorage(const std::string& dir, size_t compact_bytes)
+    : dir_(dir), compact_bytes_(std::max<size_t>(compact_bytes, JOURNAL_GROW_BYTES)) {}
+
+std::string JournalStorage::logPath(uint64_t generation) const {
+    return dir_ + "/log." + std::to_string(generation);
+}
+
+std::vector<uint64_t> JournalStorage::listLogs() const {
+    std::vector<uint64_t> generations;
+    DIR* dir = opendir(dir_.c_str());
+    if (dir == nullptr) {
+        return generations;
+    }
+    while (dirent* entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name.compare(0, 4, "log.") == 0 && name.size() > 4 &&
+            name.find_first_not_of("0123456789", 4) == std::string::npos) {
+            generations.push_back(std::stoull(name.substr(4)));
+        }
+    }
+    closedir(dir);
+    std::sort(generations.begin(), generations.end());
+    return generations;
+}
+
+void JournalStorage::removeLogsBefore(uint64_t generation) const {
+    for (uint64_t old_generation : listLogs()) {
+        if (old_generation < generation) {
+            unlink(logPath(old_generation).c_str());
+        }
+    }
+}
+
+bool JournalStorage::open() {
+    if (mkdir(dir_.c_str(), 0700) != 0 && errno != EEXIST) {
+        LOG_ERROR("Failed to create journal directory %s: %s", dir_.c_str(), strerror(errno));
+        return false;
+    }
+
+    // The wallets live in this process's memory, a second writer would never see them
+    lock_fd_ = ::open((dir_ + "/lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (lock_fd_ < 0 || flock(lock_fd_, LOCK_EX | LOCK_NB) != 0) {
+        LOG_ERROR("Journal %s is in use by another process", dir_.c_str());
+        return false;
+    }
+
+    // The snapshot holds everything before its generation's log
+    uint64_t first_generation = 0;
+    std::string snapshot_path = dir_ + "/snapshot";
+    if (access(snapshot_path.c_str(), F_OK) == 0) {
+        size_t end = 0;
+        if (!replay(snapshot_path, false, first_generation, end)) {
+            return false;
+        }
+    }
+
+    // Logs before the snapshot's generation are left over from a compaction that stopped before removing them
+    removeLogsBefore(first_generation);
+    std::vector<uint64_t> generations = listLogs();
+
+    size_t end = 0;
+    uint64_t generation = first_generation;
+    for (size_t i = 0; i < generations.size(); i++) {
+        if (!replay(logPath(generations[i]), i + 1 == generations.size(), generation, end)) {
+            return false;
+        }
+    }
+    if (!openLog(generation, end, log_)) {
+        return false;
+    }
+    journal_log_bytes.set(static_cast<int64_t>(log_.end));
+
+    compactor_ = std::thread(&JournalStorage::compactLoop, this);
+
+    LOG_INFO("Journal opened: %zu wallets, version %lld, log %llu at %zu bytes", wallets_.size(),
+             static_cast<long long>(last_version_), static_cast<unsigned long long>(log_.generation), log_.end);
+    return true;
+}
+
+void JournalStorage::close() {
+    {
+        std::lock_guard<std::mutex> lock(compact_mutex_);
+        stopping_ = true;
+    }
+    compact_cond_.notify_all();
+    if (compactor_.joinable()) {
+        compactor_.join();
+    }
+
+    if (log_.fd >= 0) {
+        std::lock_guard<std::mutex> sync_lock(sync_mutex_);
+        std::lock_guard<std::mutex> lock(append_mutex_);
+        if (!failed_ && fdatasync(log_.fd) != 0) {
+            LOG_ERROR("Failed to sync journal log: %s", strerror(errno));
+        }
+        closeLog(log_);
+    }
+    if (lock_fd_ >= 0) {
+        ::close(lock_fd_);
+        lock_fd_ = -1;
+    }
+}
+
+// Apply the file's complete commits. A commit cut short ends the replay: expected at the end of the
+// last log after a crash, anywhere else the file is damaged and the journal is not opened
+bool JournalStorage::replay(const std::string& path, bool is_last_log, uint64_t& generation, size_t& valid_end) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        LOG_ERROR("Failed to open %s: %s", path.c_str(), strerror(errno));
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return false;
+    }
+
+    size_t size = static_cast<size_t>(st.st_size);
+    size_t count = size / sizeof(JournalRecord);
+    const JournalRecord* records = nullptr;
+    if (count > 0) {
+        void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            LOG_ERROR("Failed to map %s: %s", path.c_str(), strerror(errno));
+            ::close(fd);
+            return false;
+        }
+        records = static_cast<const JournalRecord*>(data);
+        madvise(data, size, MADV_SEQUENTIAL);
+    }
+
+    valid_end = 0;
+    bool complete = false;
+    if (count > 0 && isValid(records[0]) && records[0].type == JOURNAL_HEADER &&
+        memcmp(records[0].currency, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) == 0) {
+        generation = static_cast<uint64_t>(records[0].version);
+        valid_end = sizeof(JournalRecord);
+        size_t commit_start = 1;
+        size_t i = 1;
+        for (; i < count && isValid(records[i]) && records[i].type != JOURNAL_HEADER; i++) {
+            if (records[i].last) {
+                for (size_t j = commit_start; j <= i; j++) {
+                    applyRecord(records[j]);
+                }
+                commit_start = i + 1;
+                valid_end = (i + 1) * sizeof(JournalRecord);
+            }
+        }
+        // Preallocated space is zero, a clean end has only zeros after the last commit
+        static const JournalRecord zero_record = {};
+        complete = commit_start == i && (i == count || memcmp(&records[i], &zero_record, sizeof(zero_record)) == 0);
+    } else if (is_last_log) {
+        // Created but the header never reached the disk, start it over
+        generation = std::stoull(path.substr(path.rfind('.') + 1));
+    }
+
+    if (records != nullptr) {
+        munmap(const_cast<JournalRecord*>(records), size);
+    }
+    ::close(fd);
+
+    if (!complete && !is_last_log) {
+        LOG_ERROR("Journal file %s is damaged after %zu bytes", path.c_str(), valid_end);
+        return false;
+    }
+    if (!complete) {
+        LOG_WARN("Dropped an incomplete commit at the end of %s after %zu bytes", path.c_str(), valid_end);
+    }
+    return true;
+}
+
+void JournalStorage::applyRecord(const JournalRecord& record) {
+    if (record.type == JOURNAL_HEADER) {
+        return;
+    }
+    Wallet& wallet = wallets_[std::string(record.user_id, record.user_length)];
+    wallet.version = record.version;
+    last_version_ = std::max(last_version_, record.version);
+
+    CurrencyCode code = CurrencyCode::fromChars(record.currency, 3);
+    if (record.type == JOURNAL_SET) {
+        wallet.balances[code] = record.amount;
+    } else {
+        wallet.balances.erase(code);
+    }
+}
+
+// Map the log, created with a header if end is 0. Bytes after end are cleared so a torn
+// commit from before a crash can't be read back behind the new ones
+bool JournalStorage::openLog(uint64_t generation, size_t end, Log& log) {
+    std::string path = logPath(generation);
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        LOG_ERROR("Failed to open %s: %s", path.c_str(), strerror(errno));
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return false;
+    }
+
+    size_t size = static_cast<size_t>(st.st_size);
+    size_t capacity = std::max<size_t>((size + JOURNAL_GROW_BYTES - 1) / JOURNAL_GROW_BYTES * JOURNAL_GROW_BYTES,
+                                       JOURNAL_GROW_BYTES);
+    if (size < capacity && ftruncate(fd, static_cast<off_t>(capacity)) != 0) {
+        LOG_ERROR("Failed to size %s: %s", path.c_str(), strerror(errno));
+        ::close(fd);
+        return false;
+    }
+    void* data = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        LOG_ERROR("Failed to map %s: %s", path.c_str(), strerror(errno));
+        ::close(fd);
+        return false;
+    }
+
+    log.fd = fd;
+    log.generation = generation;
+    log.data = static_cast<char*>(data);
+    log.capacity = capacity;
+    log.end = end;
+
+    bool dirty = false;
+    static const JournalRecord zero_record = {};
+    for (size_t offset = end; offset + sizeof(JournalRecord) <= std::min(size, capacity); offset += sizeof(JournalRecord)) {
+        if (memcmp(log.data + offset, &zero_record, sizeof(zero_record)) != 0) {
+            memset(log.data + offset, 0, sizeof(JournalRecord));
+            dirty = true;
+        }
+    }
+
+    if (end == 0) {
+        JournalRecord header = makeRecord(JOURNAL_HEADER, "", static_cast<int64_t>(generation), JOURNAL_MAGIC, 0.0);
+        header.last = 1;
+        seal(header);
+        memcpy(log.data, &header, sizeof(header));
+        log.end = sizeof(header);
+        dirty = true;
+    }
+    if (dirty && (fdatasync(fd) != 0 || !syncDirectory(dir_))) {
+        LOG_ERROR("Failed to sync %s: %s", path.c_str(), strerror(errno));
+        closeLog(log);
+        return false;
+    }
+    return true;
+}
+
+void JournalStorage::closeLog(Log& log) {
+    if (log.data != nullptr) {
+        munmap(log.data, log.capacity);
+        log.data = nullptr;
+    }
+    if (log.fd >= 0) {
+        ::close(log.fd);
+        log.fd = -1;
+    }
+}
+
+// With append_mutex_ held. Either every record is appended or none
+bool JournalStorage::append(const std::vector<JournalRecord>& records) {
+    size_t bytes = records.size() * sizeof(JournalRecord);
+    if (log_.end + bytes > log_.capacity) {
+        size_t capacity = log_.capacity + std::max<size_t>(JOURNAL_GROW_BYTES, bytes);
+        if (ftruncate(log_.fd, static_cast<off_t>(capacity)) != 0) {
+            LOG_ERROR("Failed to grow journal log: %s", strerror(errno));
+            return false;
+        }
+        void* data = mremap(log_.data, log_.capacity, capacity, MREMAP_MAYMOVE);
+        if (data == MAP_FAILED) {
+            LOG_ERROR("Failed to remap journal log: %s", strerror(errno));
+            return false;
+        }
+        log_.data = static_cast<char*>(data);
+        log_.capacity = capacity;
+    }
+
+    memcpy(log_.data + log_.end, records.data(), bytes);
+    log_.end += bytes;
+    appended_ += records.size();
+    journal_records.inc(records.size());
+    journal_log_bytes.set(static_cast<int64_t>(log_.end));
+    return true;
+}
+
+// Make every record up to sequence durable. Commits that piled up while another
+// one synced are covered by a single fdatasync, which also writes back the pages
+// dirtied through the mapping
+bool JournalStorage::syncUpTo(uint64_t sequence) {
+    std::lock_guard<std::mutex> lock(sync_mutex_);
+    if (failed_) {
+        return false;
+    }
+    if (synced_ >= sequence) {
+        return true;
+    }
+
+    uint64_t target;
+    int fd;
+    {
+        std::lock_guard<std::mutex> append_lock(append_mutex_);
+        target = appended_;
+        fd = log_.fd;
+    }
+
+    ScopedTimer timer(journal_sync_seconds);
+    if (fdatasync(fd) != 0) {
+        // The page cache may have dropped the writes, nothing appended since open can be trusted
+        LOG_ERROR("Failed to sync journal log, refusing further writes: %s", strerror(errno));
+        failed_ = true;
+        return false;
+    }
+    synced_ = target;
+    journal_syncs.inc();
+    return true;
+}
+
+bool JournalStorage::loadWallet(const std::string& user_id, Balances& wallet, int64_t& version) {
+    std::shared_lock<std::shared_mutex> lock(state_mutex_);
+    auto it = wallets_.find(user_id);
+    if (it == wallets_.end()) {
+        wallet.clear();
+        version = 0;
+        return true;
+    }
+    wallet = it->second.balances;
+    version = it->second.version;
+    return true;
+}
+
+bool JournalStorage::loadAllWallets(const WalletScanFn& fn) {
+    std::shared_lock<std::shared_mutex> lock(state_mutex_);
+    for (const auto& [user_id, wallet] : wallets_) {
+        if (wallet.balances.empty()) {
+            continue;
+        }
+        Balances balances = wallet.balances;
+        fn(user_id, balances, wallet.version);
+    }
+    return true;
+}
+
+bool JournalStorage::loadCurrencyTotals(const CurrencyTotalsFn& fn, int64_t& version) {
+    std::map<CurrencyCode, std::pair<double, int64_t>> totals;
+    {
+        // No commit lands between reading the version and the wallets
+        std::lock_guard<std::mutex> append_lock(append_mutex_);
+        std::shared_lock<std::shared_mutex> lock(state_mutex_);
+        version = last_version_;
+        for (const auto& [user_id, wallet] : wallets_) {
+            for (const Balances::Entry& entry : wallet.balances) {
+                auto& total = totals[entry.code];
+                total.first += entry.amount;
+                total.second++;
+            }
+        }
+    }
+    for (const auto& [code, total] : totals) {
+        fn(code, total.first, total.second);
+    }
+    return true;
+}
+
+DBWriteResult JournalStorage::commit(const std::string& user_id, int64_t expected_version,
+                                     const std::vector<DBMutation>& mutations, int64_t& new_version) {
+    for (const DBMutation& m : mutations) {
+        if (m.user_id.size() > JOURNAL_USER_ID_MAX || !CurrencyCode::fromString(m.currency).valid()) {
+            LOG_ERROR("Can't journal a write of %s for user %s", m.currency.c_str(), m.user_id.c_str());
+            return DBWriteResult::Failed;
+        }
+    }
+
+    uint64_t sequence;
+    {
+        std::lock_guard<std::mutex> lock(append_mutex_);
+        if (!user_id.empty() && expected_version >= 0) {
+            std::shared_lock<std::shared_mutex> state_lock(state_mutex_);
+            auto it = wallets_.find(user_id);
+            if ((it == wallets_.end() ? 0 : it->second.version) != expected_version) {
+                journal_conflicts.inc();
+                return DBWriteResult::Conflict;
+            }
+        }
+
+        // One new version per touched user
+        std::unordered_map<std::string, int64_t> versions;
+        int64_t next_version = last_version_;
+        std::vector<JournalRecord> records;
+        records.reserve(mutations.size());
+        for (const DBMutation& m : mutations) {
+            auto [it, inserted] = versions.try_emplace(m.user_id, next_version + 1);
+            if (inserted) {
+                next_version++;
+            }
+            CurrencyCode code = CurrencyCode::fromString(m.currency);
+            records.push_back(makeRecord(m.remove ? JOURNAL_REMOVE : JOURNAL_SET, m.user_id, it->second,
+                                         code.str().c_str(), m.remove ? 0.0 : m.amount));
+        }
+        if (records.empty()) {
+            new_version = expected_version;
+            return DBWriteResult::Ok;
+        }
+        records.back().last = 1;
+        for (JournalRecord& record : records) {
+            seal(record);
+        }
+
+        if (!append(records)) {
+            return DBWriteResult::Failed;
+        }
+        last_version_ = next_version;
+        {
+            std::unique_lock<std::shared_mutex> state_lock(state_mutex_);
+            for (const JournalRecord& record : records) {
+                applyRecord(record);
+            }
+        }
+        auto owner = versions.find(user_id);
+        new_version = owner != versions.end() ? owner->second : next_version;
+        sequence = appended_;
+
+        if (log_.end >= compact_bytes_) {
+            std::lock_guard<std::mutex> compact_lock(compact_mutex_);
+            compact_requested_ = true;
+            compact_cond_.notify_one();
+        }
+    }
+
+    return syncUpTo(sequence) ? DBWriteResult::Ok : DBWriteResult::Failed;
+}
+
+int64_t JournalStorage::latestVersion() {
+    std::lock_guard<std::mutex> lock(append_mutex_);
+    return last_version_;
+}
+
+bool JournalStorage::startChangeFeed(int64_t, int, DBChangeCallback) {
+    // The directory lock keeps every other process out, nothing to follow
+    return true;
+}
+
+void JournalStorage::compactLoop() {
+    std::unique_lock<std::mutex> lock(compact_mutex_);
+    while (true) {
+        compact_cond_.wait(lock, [this] { return compact_requested_ || stopping_; });
+        if (stopping_) {
+            return;
+        }
+        lock.unlock();
+        bool ok = compact();
+        (ok ? journal_compactions_ok : journal_compactions_failed).inc();
+        lock.lock();
+        // Requests made while compacting saw the old log, the next commit asks again if the new one is full
+        compact_requested_ = false;
+    }
+}
+
+// Switch appends to a new log, then write every wallet as of the switch to the snapshot
+// Only once the snapshot is in place are the older logs removed
+bool JournalStorage::compact() {
+    Log old_log;
+    std::unordered_map<std::string, Wallet> wallets;
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> sync_lock(sync_mutex_);
+        std::lock_guard<std::mutex> lock(append_mutex_);
+        if (failed_) {
+            return false;
+        }
+        // Whatever the snapshot holds must already be durable in the log it replaces
+        if (fdatasync(log_.fd) != 0) {
+            LOG_ERROR("Failed to sync journal log, refusing further writes: %s", strerror(errno));
+            failed_ = true;
+            return false;
+        }
+        synced_ = appended_;
+
+        Log next;
+        if (!openLog(log_.generation + 1, 0, next)) {
+            return false;
+        }
+        {
+            std::shared_lock<std::shared_mutex> state_lock(state_mutex_);
+            wallets = wallets_;
+        }
+        old_log = log_;
+        log_ = next;
+        generation = log_.generation;
+        journal_log_bytes.set(static_cast<int64_t>(log_.end));
+    }
+    closeLog(old_log);
+
+    std::string snapshot_path = dir_ + "/snapshot";
+    std::string tmp_path = snapshot_path + ".tmp";
+    int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        LOG_ERROR("Failed to create %s: %s", tmp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    // Same records as the log, one commit per currency
+    std::vector<JournalRecord> records;
+    JournalRecord header = makeRecord(JOURNAL_HEADER, "", static_cast<int64_t>(generation), JOURNAL_MAGIC, 0.0);
+    header.last = 1;
+    seal(header);
+    records.push_back(header);
+    size_t held = 0;
+    for (const auto& [user_id, wallet] : wallets) {
+        for (const Balances::Entry& entry : wallet.balances) {
+            JournalRecord record = makeRecord(JOURNAL_SET, user_id, wallet.version, entry.code.str().c_str(), entry.amount);
+            record.last = 1;
+            seal(record);
+            records.push_back(record);
+        }
+        held += wallet.balances.empty() ? 0 : 1;
+    }
+
+    const char* data = reinterpret_cast<const char*>(records.data());
+    size_t remaining = records.size() * sizeof(JournalRecord);
+    bool ok = true;
+    while (ok && remaining > 0) {
+        ssize_t written = write(fd, data, remaining);
+        ok = written > 0;
+        data += ok ? written : 0;
+        remaining -= ok ? static_cast<size_t>(written) : 0;
+    }
+    ok = ok && fdatasync(fd) == 0;
+    ::close(fd);
+    if (!ok || rename(tmp_path.c_str(), snapshot_path.c_str()) != 0 || !syncDirectory(dir_)) {
+        LOG_ERROR("Failed to write journal snapshot %s: %s", snapshot_path.c_str(), strerror(errno));
+        unlink(tmp_path.c_str());
+        return false;
+    }
+
+    // Every log before the new one is in the snapshot now
+    removeLogsBefore(generation);
+
+    LOG_INFO("Journal snapshot written: %zu wallets, log %llu started", held, static_cast<unsigned long long>(generation));
+    return true;
+}
@@ -0,0 +1,112 @@
+#ifndef JOURNAL_STORAGE_H
+#define JOURNAL_STORAGE_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include "storage.h"
+
+#define JOURNAL_USER_ID_MAX     64              // longer user ids can't be stored in a record
+#define JOURNAL_GROW_BYTES      (4u << 20)      // the log file and its mapping grow in steps of this
+
+// Fixed-size log record, written to the mapped log as is
+// A commit is a run of records, the last one has last = 1. A run cut short by a crash is dropped on replay
+struct JournalRecord {
+    uint32_t checksum;      // crc32 of everything after this field
+    uint8_t type;           // JournalRecordType
+    uint8_t last;
+    uint8_t user_length;
+    uint8_t reserved;
+    int64_t version;        // the user's version after the commit, the generation in a header
+    double amount;
+    char currency[4];
+    uint32_t reserved2;
+    char user_id[JOURNAL_USER_ID_MAX];
+};
+static_assert(sizeof(JournalRecord) == 96, "journal records are 96 bytes on disk");
+
+enum JournalRecordType : uint8_t {
+    JOURNAL_HEADER = 1,     // first record of every file
+    JOURNAL_SET = 2,
+    JOURNAL_REMOVE = 3
+};
+
+// Wallets kept in memory, every change appended to a memory-mapped log in <dir>/log.<generation>
+// When the log outgrows compact_bytes a background thread writes all wallets to <dir>/snapshot
+// and removes the older logs. Startup replays the snapshot and then the logs after it
+// Commits are group synced: whoever syncs first makes every record appended so far durable
+// The directory is locked, one process at a time, so there are no foreign changes to follow
+class JournalStorage : public StorageEngine {
+public:
+    JournalStorage(const std::string& dir, size_t compact_bytes);
+
+    bool open() override;
+    void close() override;
+
+    bool loadWallet(const std::string& user_id, Balances& wallet, int64_t& version) override;
+    bool loadAllWallets(const WalletScanFn& fn) override;
+    bool loadCurrencyTotals(const CurrencyTotalsFn& fn, int64_t& version) override;
+
+    DBWriteResult commit(const std::string& user_id, int64_t expected_version,
+                         const std::vector<DBMutation>& mutations, int64_t& new_version) override;
+
+    int64_t latestVersion() override;
+    bool startChangeFeed(int64_t since_version, int interval_ms, DBChangeCallback on_change) override;
+
+private:
+    struct Wallet {
+        Balances balances;
+        int64_t version = 0;
+    };
+
+    // Mapped log file being appended to
+    struct Log {
+        int fd = -1;
+        uint64_t generation = 0;
+        char* data = nullptr;
+        size_t capacity = 0;    // file and mapping size
+        size_t end = 0;         // bytes holding records
+    };
+
+    std::string logPath(uint64_t generation) const;
+    std::vector<uint64_t> listLogs() const;         // generations of the log files, ascending
+    void removeLogsBefore(uint64_t generation) const;
+    bool replay(const std::string& path, bool is_last_log, uint64_t& generation, size_t& valid_end);
+    void applyRecord(const JournalRecord& record);
+    bool openLog(uint64_t generation, size_t end, Log& log);
+    static void closeLog(Log& log);
+    bool append(const std::vector<JournalRecord>& records);
+    bool syncUpTo(uint64_t sequence);
+    void compactLoop();
+    bool compact();
+
+    std::string dir_;
+    size_t compact_bytes_;
+    int lock_fd_ = -1;
+
+    std::shared_mutex state_mutex_;                 // guards wallets_
+    std::unordered_map<std::string, Wallet> wallets_;
+
+    std::mutex append_mutex_;                       // guards log_, appended_, last_version_
+    Log log_;
+    uint64_t appended_ = 0;                         // records appended since open
+    int64_t last_version_ = 0;
+
+    std::mutex sync_mutex_;                         // taken before append_mutex_ when both are needed
+    uint64_t synced_ = 0;                           // records known to be durable
+    bool failed_ = false;                           // a sync failed, what was appended may be lost
+
+    std::mutex compact_mutex_;
+    std::condition_variable compact_cond_;
+    bool compact_requested_ = false;
+    bool stopping_ = false;
+    std::thread compactor_;
+};
+
+#endif // JOURNAL_STORAGE_H
@@ -0,0 +1,262 @@
+#include "logger.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+std::atomic<int> log_min_level{static_cast<int>(LogLevel::Info)};
+
+// Slot of the bounded multi-producer ring buffer (Vyukov queue)
+// seq == position: free for the producer claiming it
+// seq == position + 1: filled, ready for the writer thread
+struct LogSlot {
+    std::atomic<size_t> seq;
+    LogLevel level;
+    std::chrono::system_clock::time_point time;
+    uint32_t length;
+    char message[LOG_MESSAGE_MAX];
+};
+
+// Set in enqueue_pos by stopLogger(): claims fail from then on, so the claimed range is final
+static const size_t RING_CLOSED = ~(~static_cast<size_t>(0) >> 1);
+
+static std::unique_ptr<LogSlot[]> slots;
+static size_t slot_mask = 0;
+static std::atomic<size_t> enqueue_pos{RING_CLOSED};
+static size_t dequeue_pos = 0;     // only touched by the writer thread
+
+static LogDropPolicy drop_policy = LogDropPolicy::DropNewest;
+static std::atomic<bool> running{false};
+static std::atomic<bool> writer_sleeping{false};
+static std::atomic<uint64_t> dropped{0};
+static FILE* sink = stdout;
+static std::thread writer_thread;
+static std::mutex writer_mutex;
+static std::condition_variable writer_cond;
+
+static const char* levelName(LogLevel level) {
+    switch (level) {
+        case LogLevel::Debug: return "DEBUG";
+        case LogLevel::Info:  return "INFO ";
+        case LogLevel::Warn:  return "WARN ";
+        case LogLevel::Error: return "ERROR";
+        default:              return "     ";
+    }
+}
+
+// "2026-01-01T12:00:00.000Z INFO  message\n"
+static size_t formatLine(char* out, size_t size, LogLevel level,
+                         std::chrono::system_clock::time_point time, const char* message, size_t length) {
+    time_t seconds = std::chrono::system_clock::to_time_t(time);
+    long millis = std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count() % 1000;
+    struct tm utc;
+    gmtime_r(&seconds, &utc);
+
+    size_t n = strftime(out, size, "%Y-%m-%dT%H:%M:%S", &utc);
+    int written = snprintf(out + n, size - n, ".%03ldZ %s %.*s\n", millis, levelName(level), static_cast<int>(length), message);
+    if (written < 0) {
+        return n;
+    }
+    return std::min(n + static_cast<size_t>(written), size - 1);
+}
+
+// Synchronous path used while the writer thread is not running
+static void writeDirect(LogLevel level, const char* message, size_t length) {
+    char line[LOG_MESSAGE_MAX + 64];
+    size_t n = formatLine(line, sizeof(line), level, std::chrono::system_clock::now(), message, length);
+    fwrite(line, 1, n, stdout);
+    fflush(stdout);
+}
+
+void logWrite(LogLevel level, const char* format, ...) {
+    // Claim a slot, unless the writer isn't running or stopLogger() closed the ring
+    LogSlot* slot = nullptr;
+    bool claimed = running.load(std::memory_order_acquire);
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    while (claimed) {
+        if (pos & RING_CLOSED) {
+            claimed = false;
+            break;
+        }
+        slot = &slots[pos & slot_mask];
+        size_t seq = slot->seq.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+        if (diff == 0) {
+            if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // Buffer full
+            if (drop_policy == LogDropPolicy::DropNewest) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            writer_cond.notify_one();
+            std::this_thread::yield();
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+        } else {
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    if (!claimed) {
+        char message[LOG_MESSAGE_MAX];
+        va_list args;
+        va_start(args, format);
+        int length = vsnprintf(message, sizeof(message), format, args);
+        va_end(args);
+        writeDirect(level, message, std::min<size_t>(length < 0 ? 0 : length, sizeof(message) - 1));
+        return;
+    }
+
+    slot->level = level;
+    slot->time = std::chrono::system_clock::now();
+
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(slot->message, sizeof(slot->message), format, args);
+    va_end(args);
+    slot->length = static_cast<uint32_t>(std::min<size_t>(length < 0 ? 0 : length, sizeof(slot->message) - 1));
+
+    // Publish to the writer
+    slot->seq.store(pos + 1, std::memory_order_release);
+
+    if (writer_sleeping.load(std::memory_order_relaxed)) {
+        writer_cond.notify_one();
+    }
+}
+
+// Drain everything published so far into one write
+static size_t drain(std::string& batch) {
+    char line[LOG_MESSAGE_MAX + 64];
+    size_t count = 0;
+
+    for (;;) {
+        LogSlot& slot = slots[dequeue_pos & slot_mask];
+        if (slot.seq.load(std::memory_order_acquire) != dequeue_pos + 1) {
+            break;
+        }
+
+        size_t n = formatLine(line, sizeof(line), slot.level, slot.time, slot.message, slot.length);
+        batch.append(line, n);
+
+        // Hand the slot back to producers for the next lap
+        slot.seq.store(dequeue_pos + slot_mask + 1, std::memory_order_release);
+        dequeue_pos++;
+        count++;
+    }
+
+    if (!batch.empty()) {
+        fwrite(batch.data(), 1, batch.size(), sink);
+        fflush(sink);
+        batch.clear();
+    }
+    return count;
+}
+
+static void writerLoop() {
+    std::string batch;
+    batch.reserve(64 * 1024);
+    uint64_t reported_drops = 0;
+
+    while (running.load(std::memory_order_acquire)) {
+        if (drain(batch) == 0) {
+            std::unique_lock<std::mutex> lock(writer_mutex);
+            writer_sleeping.store(true, std::memory_order_relaxed);
+            writer_cond.wait_for(lock, std::chrono::milliseconds(LOG_FLUSH_INTERVAL_MS));
+            writer_sleeping.store(false, std::memory_order_relaxed);
+        }
+
+        uint64_t drops = dropped.load(std::memory_order_relaxed);
+        if (drops != reported_drops) {
+            char message[LOG_MESSAGE_MAX];
+            int length = snprintf(message, sizeof(message), "Log buffer full, dropped %llu messages",
+                                  static_cast<unsigned long long>(drops - reported_drops));
+            char line[LOG_MESSAGE_MAX + 64];
+            size_t n = formatLine(line, sizeof(line), LogLevel::Warn, std::chrono::system_clock::now(), message, length);
+            fwrite(line, 1, n, sink);
+            reported_drops = drops;
+        }
+    }
+
+    // The ring was closed before running was cleared, so no slot is claimed after this point
+    // Wait for producers still filling a claimed slot so nothing is lost
+    size_t end = enqueue_pos.load(std::memory_order_acquire) & ~RING_CLOSED;
+    while (dequeue_pos != end) {
+        if (drain(batch) == 0) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+bool startLogger(const LoggerConfig& config) {
+    if (running.load()) {
+        return true;
+    }
+
+    size_t capacity = 2;
+    while (capacity < config.capacity) {
+        capacity <<= 1;
+    }
+
+    slots.reset(new LogSlot[capacity]);
+    for (size_t i = 0; i < capacity; i++) {
+        slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+    slot_mask = capacity - 1;
+    dequeue_pos = 0;
+    drop_policy = config.drop_policy;
+    setLogLevel(config.level);
+
+    sink = stdout;
+    if (!config.file.empty()) {
+        sink = fopen(config.file.c_str(), "a");
+        if (!sink) {
+            sink = stdout;
+            LOG_ERROR("Failed to open log file %s, logging to stdout", config.file.c_str());
+        }
+    }
+
+    enqueue_pos.store(0, std::memory_order_relaxed);
+    running.store(true, std::memory_order_release);
+    writer_thread = std::thread(writerLoop);
+    return true;
+}
+
+void stopLogger() {
+    // Close the ring before the writer is told to stop, it then knows the last slot it has to wait for
+    if (enqueue_pos.fetch_or(RING_CLOSED, std::memory_order_acq_rel) & RING_CLOSED) {
+        return;
+    }
+    running.store(false, std::memory_order_release);
+    writer_cond.notify_one();
+    if (writer_thread.joinable()) {
+        writer_thread.join();
+    }
+    if (sink != stdout) {
+        fclose(sink);
+        sink = stdout;
+    }
+}
+
+void setLogLevel(LogLevel level) {
+    log_min_level.store(static_cast<int>(level), std::memory_order_relaxed);
+}
+
+LogLevel parseLogLevel(const std::string& name, LogLevel default_level) {
+    if (name == "debug") return LogLevel::Debug;
+    if (name == "info") return LogLevel::Info;
+    if (name == "warn") return LogLevel::Warn;
+    if (name == "error") return LogLevel::Error;
+    if (name == "off") return LogLevel::Off;
+    return default_level;
+}
+
+uint64_t droppedLogMessages() {
+    return dropped.load(std::memory_order_relaxed);
+}
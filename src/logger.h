@@ -0,0 +1,68 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <string>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#define LOG_RING_CAPACITY       8192    // messages, rounded up to a power of two
+#define LOG_MESSAGE_MAX         256     // longer messages are truncated
+#define LOG_FLUSH_INTERVAL_MS   10      // how long the writer sleeps when the buffer is empty
+
+enum class LogLevel : int {
+    Debug = 0,
+    Info,
+    Warn,
+    Error,
+    Off
+};
+
+// What producers do when the ring buffer is full
+enum class LogDropPolicy {
+    DropNewest,     // discard the message and count it
+    Block           // wait for the writer thread to make room
+};
+
+struct LoggerConfig {
+    LogLevel level = LogLevel::Info;
+    LogDropPolicy drop_policy = LogDropPolicy::DropNewest;
+    std::string file;               // empty: stdout
+    size_t capacity = LOG_RING_CAPACITY;
+};
+
+// Start the background writer, messages logged before go straight to stdout
+bool startLogger(const LoggerConfig& config);
+
+// Write out everything still buffered and stop the writer
+void stopLogger();
+
+// Runtime level filter
+void setLogLevel(LogLevel level);
+LogLevel parseLogLevel(const std::string& name, LogLevel default_level);
+
+// Number of messages discarded because the buffer was full
+uint64_t droppedLogMessages();
+
+// Level check used by the LOG_* macros, arguments are not evaluated for filtered levels
+extern std::atomic<int> log_min_level;
+inline bool logEnabled(LogLevel level) {
+    return static_cast<int>(level) >= log_min_level.load(std::memory_order_relaxed);
+}
+
+// printf-style formatting straight into the ring buffer slot, no allocation
+void logWrite(LogLevel level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+#define LOG_AT(level, ...)                              \
+    do {                                                \
+        if (logEnabled(level)) {                        \
+            logWrite(level, __VA_ARGS__);               \
+        }                                               \
+    } while (0)
+
+#define LOG_DEBUG(...)  LOG_AT(LogLevel::Debug, __VA_ARGS__)
+#define LOG_INFO(...)   LOG_AT(LogLevel::Info, __VA_ARGS__)
+#define LOG_WARN(...)   LOG_AT(LogLevel::Warn, __VA_ARGS__)
+#define LOG_ERROR(...)  LOG_AT(LogLevel::Error, __VA_ARGS__)
+
+#endif // LOGGER_H
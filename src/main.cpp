@@ -1,57 +1,478 @@
-#include <iostream>
 #include <map>
 #include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <csignal>
+#include <cstdlib>
+#include <pthread.h>
 #include "../third_party/httplib.h"
 #include "../third_party/json.hpp"
-#include <algorithm>
-#include <cctype>
 #include "nbp_client.h"
 #include "database.h"
 #include "utils.h"
 #include "auth.h"
+#include "wallet_store.h"
+#include "currency.h"
+#include "validation.h"
+#include "response_cache.h"
+#include "logger.h"
+#include "metrics.h"
+#include "wallet_response.h"
+#include "worker_pool.h"
+#include "response_encoder.h"
+#include "rate_history.h"
+#include "tracing.h"
+#include "exposure.h"
+#include "stream_hub.h"
+
+#define WALLET_BATCH_MAX_OPERATIONS 100
 
 // Wallet for each user
-std::map<std::string, std::map<std::string, double>> user_wallets;
+WalletStore wallet_store;
+
+// Serialized GET /wallet bodies per user
+ResponseCache wallet_responses;
+
+static Counter& fast_parsed_bodies = metrics().counter(
+    "wallet_request_parse_total", "Add/sub bodies by parser", {{"parser", "fast"}});
+static Counter& full_parsed_bodies = metrics().counter(
+    "wallet_request_parse_total", "Add/sub bodies by parser", {{"parser", "full"}});
+
+// Wrap a handler to count requests by status class and record latency per route
+// The request gets an X-Request-Id (the client's or a new one) and, if sampled, a trace span per route
+static httplib::Server::Handler instrumented(const std::string& method, const std::string& route,
+                                             httplib::Server::Handler handler) {
+    const char* span_name = traceName(method + " " + route);
+    MetricLabels labels = {{"method", method}, {"route", route}};
+    Histogram* latency = &metrics().histogram("wallet_http_request_duration_seconds", "HTTP request latency", labels);
+
+    Counter* requests[6] = {};
+    for (int status_class = 2; status_class <= 5; status_class++) {
+        MetricLabels with_code = labels;
+        with_code.push_back({"code", std::to_string(status_class) + "xx"});
+        requests[status_class] = &metrics().counter("wallet_http_requests_total", "HTTP requests", with_code);
+    }
+
+    return [latency, requests, handler, span_name](const httplib::Request& req, httplib::Response& res) {
+        ScopedTimer timer(*latency);
+        TraceRequest trace(span_name, req.get_header_value("X-Request-Id"));
+        res.set_header("X-Request-Id", trace.requestId());
+        try {
+            handler(req, res);
+        } catch (...) {
+            requests[5]->inc();
+            throw;
+        }
+        // Status is still -1 when the handler relies on httplib's default 200
+        int status_class = res.status == -1 ? 2 : res.status / 100;
+        requests[(status_class >= 2 && status_class <= 5) ? status_class : 5]->inc();
+    };
+}
+
+// Respond with 500 when the user's wallet can't be loaded from database
+static void setWalletLoadError(const httplib::Request& req, httplib::Response& res) {
+    res.status = 500;
+    json error_response;
+    error_response["error"] = "Failed to load wallet from database";
+    sendJson(req, res, error_response);
+}
+
+// Response for an update that did not go through, returns false if it did
+static bool setWalletUpdateError(const httplib::Request& req, httplib::Response& res, WalletUpdate result) {
+    json error_response;
+    switch (result) {
+        case WalletUpdate::Ok:
+            return false;
+        case WalletUpdate::LoadFailed:
+            setWalletLoadError(req, res);
+            return true;
+        case WalletUpdate::SaveFailed:
+            res.status = 500;
+            error_response["error"] = "Failed to save to database";
+            break;
+        case WalletUpdate::Conflict:
+            res.status = 409;
+            error_response["error"] = "Wallet is being changed by another process, try again";
+            break;
+    }
+    sendJson(req, res, error_response);
+    return true;
+}
+
+// Per-currency totals as aggregated by the database, and the latest version they include
+static bool loadStoredTotals(std::vector<CurrencyExposure>& totals, int64_t& version) {
+    totals.clear();
+    return loadCurrencyTotalsFromDB([&totals](CurrencyCode code, double amount, int64_t holders) {
+        totals.push_back({code, amount, holders});
+    }, version);
+}
+
+// Change feed callback: wallets written by other processes sharing the database
+static void onDatabaseChanges(const DBChanges& changes) {
+    for (const auto& [user_id, version] : changes.wallets) {
+        wallet_store.invalidate(user_id, version);
+        streamHub().notifyUser(user_id);
+    }
+    if (changes.totals_complete) {
+        for (const DBTotalsDelta& delta : changes.totals) {
+            exposure().apply(delta);
+        }
+    } else if (!exposure().rebuild(loadStoredTotals)) {
+        // This process fell too far behind, the deltas it missed are gone
+        LOG_WARN("Failed to rebuild exposure totals after %zu foreign changes", changes.wallets.size());
+    }
+    LOG_DEBUG("Picked up %zu wallet changes from other processes", changes.wallets.size());
+}
+
+// Read currency and amount of an add/sub body, responds with 400 and returns false if invalid
+static bool parseWalletOperation(const httplib::Request& req, httplib::Response& res, WalletOperation& op) {
+    // Almost every body has the plain {"currency":"XXX","amount":N} shape
+    if (parseWalletOperationFast(req.body.data(), req.body.size(), op)) {
+        fast_parsed_bodies.inc();
+        return true;
+    }
+    full_parsed_bodies.inc();
+
+    json req_data;
+
+    // Parse JSON with error handling
+    try {
+        req_data = json::parse(req.body);
+    } catch(const json::parse_error& e) {
+        res.status = 400;
+        json error_response;
+        error_response["error"] = "Invalid JSON";
+        error_response["details"] = e.what();
+        sendJson(req, res, error_response);
+        return false;
+    }
+
+    // Validate currency and amount
+    json error_response;
+    if (!validateWalletOperation(req_data, op, error_response)) {
+        res.status = 400;
+        sendJson(req, res, error_response);
+        return false;
+    }
+    return true;
+}
+
+// Current valuation of the user's wallet as one Server-Sent Event
+// Returns false if nothing changed since last_data, which is updated otherwise
+static bool buildWalletEvent(const std::string& user_id, std::string& last_data, std::string& event) {
+    Balances wallet;
+    uint64_t wallet_version = 0;
+    bool loaded = wallet_store.read(user_id, [&](const Balances& balances, uint64_t version) {
+        wallet = balances;
+        wallet_version = version;
+    });
+
+    std::shared_ptr<const RateSnapshot> rate_snapshot = getRateSnapshot();
+    json data;
+    std::string name = "wallet";
+    if (!loaded) {
+        name = "error";
+        data["error"] = "Failed to load wallet";
+    } else if (!rate_snapshot || rate_snapshot->rates.empty()) {
+        name = "error";
+        data["error"] = "Failed to fetch exchange rates from NBP";
+    } else {
+        for (const Balances::Entry& entry : wallet) {
+            if (!rate_snapshot->rates.has(entry.code)) {
+                rate_snapshot = resolveMissingRates(rate_snapshot);
+                break;
+            }
+        }
+        data = buildWalletResponse(wallet, rate_snapshot->rates);
+    }
+
+    // A new snapshot with the same rates, or add then sub of the same amount, is not worth an event
+    std::string body = data.dump();
+    if (body == last_data) {
+        return false;
+    }
+    last_data = body;
+
+    event = "event: " + name + "\n";
+    if (name == "wallet") {
+        event += "id: " + std::to_string(wallet_version) + "-" + std::to_string(rate_snapshot->id) + "\n";
+    }
+    event += "data: " + body + "\n\n";
+    return true;
+}
+
+// POST /wallet/add and /wallet/sub, which differ only in how the balance changes
+static void handleWalletMutation(const httplib::Request& req, httplib::Response& res, bool subtract) {
+    // Authenticate request
+    std::string user_id = authenticateRequest(req, res);
+    if (user_id.empty()) {
+        return;
+    }
+
+    WalletOperation op;
+    if (!parseWalletOperation(req, res, op)) {
+        return;
+    }
+    CurrencyCode code = op.code;
+    double amount = op.amount;
+    std::string currency = code.str();
+
+    bool found = false;
+    double available = 0.0;
+    double new_amount = 0.0;
+
+    // Check and change under one lock so concurrent requests can't overdraw,
+    // the store saves the change before the lock is released
+    WalletUpdate result = wallet_store.update(user_id, [&](Balances& wallet) {
+        // Runs again if another process changed the wallet in between
+        found = false;
+        available = 0.0;
+        new_amount = 0.0;
+
+        if (!subtract) {
+            double& balance = wallet[code];
+            balance += amount;
+            new_amount = balance;
+            return;
+        }
+
+        // Check if there is the requested currency in wallet
+        double* balance = wallet.find(code);
+        if (balance == nullptr) {
+            return;
+        }
+        found = true;
+        available = *balance;
+
+        // Check if there is enough funds in wallet
+        if (available < amount) {
+            return;
+        }
+
+        *balance -= amount;
+        new_amount = *balance;
+
+        // Delete if zero (or close to zero due to double type amount)
+        if (new_amount <= 0.01) {
+            wallet.erase(code);
+        }
+    });
+    if (setWalletUpdateError(req, res, result)) {
+        return;
+    }
+
+    if (subtract && !found) {
+        res.status = 400;
+        json error_response;
+        error_response["error"] = "No such currency in wallet";
+        error_response["currency"] = currency;
+        sendJson(req, res, error_response);
+        return;
+    }
+
+    if (subtract && available < amount) {
+        res.status = 400;
+        json error_response;
+        error_response["error"] = "Not enough funds";
+        error_response["currency"] = currency;
+        error_response["available"] = available;
+        error_response["requested"] = amount;
+        sendJson(req, res, error_response);
+        return;
+    }
+
+    json response;
+    response["message"] = subtract ? "Currency subsracted" : "Currency added";
+    response["currency"] = currency;
+    response["amount"] = roundTo2Decimals(amount);
+    response["total"] = roundTo2Decimals(new_amount);
+
+    sendJson(req, res, response);
+}
 
 int main() {
-    std::cout << "Currency Wallet API" << std::endl;
+    // Handle SIGINT/SIGTERM/SIGHUP on a dedicated thread, block them before any other thread starts
+    sigset_t handled_signals;
+    sigemptyset(&handled_signals);
+    sigaddset(&handled_signals, SIGINT);
+    sigaddset(&handled_signals, SIGTERM);
+    sigaddset(&handled_signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &handled_signals, nullptr);
+
+    // Asynchronous logger, debug lines are filtered out unless enabled
+    LoggerConfig log_config;
+    log_config.level = parseLogLevel(getEnvString("WALLET_LOG_LEVEL", "info"), LogLevel::Info);
+    log_config.file = getEnvString("WALLET_LOG_FILE", "");
+    log_config.drop_policy = getEnvString("WALLET_LOG_DROP_POLICY", "drop") == "block"
+        ? LogDropPolicy::Block : LogDropPolicy::DropNewest;
+    log_config.capacity = getEnvInt("WALLET_LOG_BUFFER", LOG_RING_CAPACITY);
+    startLogger(log_config);
+
+    LOG_INFO("Currency Wallet API");
+
+    std::string db_path = getEnvString("WALLET_DB_PATH", DB_DEFAULT_PATH);
+    size_t db_dir_end = db_path.rfind('/');
+    std::string db_dir = db_dir_end == std::string::npos ? "" : db_path.substr(0, db_dir_end + 1);
+
+    // NBP HTTP client settings, saved rates live next to the database by default
+    NBPClientConfig nbp_config;
+    nbp_config.base_url = getEnvString("NBP_BASE_URL", NBP_DEFAULT_BASE_URL);
+    nbp_config.connect_timeout_ms = getEnvInt("NBP_CONNECT_TIMEOUT_MS", NBP_CONNECT_TIMEOUT_MS);
+    nbp_config.timeout_ms = getEnvInt("NBP_TIMEOUT_MS", NBP_TIMEOUT_MS);
+    nbp_config.gzip = getEnvInt("NBP_GZIP", 1) != 0;
+    nbp_config.rates_file = getEnvString("NBP_RATES_FILE", db_dir + "nbp_rates.json");
+    configureNBPClient(nbp_config);
+    rateHistory().setFile(getEnvString("NBP_HISTORY_FILE", db_dir + "rate_history.bin"));
+
+    setDatabasePath(db_path);
+    std::string storage_engine = getEnvString("WALLET_STORAGE", DB_DEFAULT_ENGINE);
+    if (!setStorageEngine(storage_engine)) {
+        LOG_ERROR("Unknown storage engine %s, expected sqlite or journal", storage_engine.c_str());
+        stopLogger();
+        return 1;
+    }
+    setJournalCompactSize(static_cast<size_t>(getEnvInt("WALLET_JOURNAL_COMPACT_MB", DB_JOURNAL_COMPACT_MB)) << 20);
+
+    // Group commit limits can be tuned per deployment
+    setGroupCommitConfig(getEnvInt("WALLET_DB_BATCH_MAX_SIZE", DB_BATCH_MAX_SIZE),
+                         getEnvInt("WALLET_DB_BATCH_MAX_WAIT_MS", DB_BATCH_MAX_WAIT_MS));
+
+    // API keys and their default per-key rate limit (0 = unlimited)
+    RateLimit default_limit;
+    default_limit.rate = std::max(0.0, std::atof(getEnvString("WALLET_RATE_LIMIT_RPS", "0").c_str()));
+    default_limit.burst = std::atof(getEnvString("WALLET_RATE_LIMIT_BURST", "0").c_str());
+    if (default_limit.burst < 1.0) {
+        default_limit.burst = std::max(1.0, default_limit.rate);
+    }
+    if (!loadApiKeys(getEnvString("WALLET_API_KEYS_FILE", ""), default_limit)) {
+        LOG_ERROR("Failed to load API keys");
+        stopLogger();
+        return 1;
+    }
+    setAdminKey(getEnvString("WALLET_ADMIN_KEY", ""));
+
+    // Sampled requests are traced to a Chrome trace-event file, off unless a file is given
+    TracerConfig trace_config;
+    trace_config.file = getEnvString("WALLET_TRACE_FILE", "");
+    trace_config.sample_rate = std::atof(getEnvString("WALLET_TRACE_SAMPLE_RATE", "0.01").c_str());
+    trace_config.buffer_events = getEnvInt("WALLET_TRACE_BUFFER", TRACE_BUFFER_EVENTS);
+    startTracer(trace_config);
 
     // Initialize database
     if (!initDatabase()) {
-        std::cerr << "Failed to initialize database" << std::endl;
+        LOG_ERROR("Failed to initialize database");
+        stopTracer();
+        stopLogger();
+        return 1;
+    }
+
+    // Exposure totals start from what the database holds, updates keep them current from here on
+    // Changes by other processes sharing the database are followed from the version they include
+    std::vector<CurrencyExposure> stored_totals;
+    int64_t synced_version = 0;
+    if (!loadStoredTotals(stored_totals, synced_version)) {
+        LOG_ERROR("Failed to load currency totals");
+        closeDatabase();
+        stopTracer();
+        stopLogger();
         return 1;
     }
+    exposure().reset(stored_totals, synced_version);
+    LOG_INFO("Exposure totals rebuilt for %zu currencies", stored_totals.size());
 
     httplib::Server srv;
+
+    // Fixed worker pool with a bounded queue, connections beyond it get a fast 503
+    long hardware_threads = static_cast<long>(std::thread::hardware_concurrency());
+    size_t worker_threads = getEnvInt("WALLET_WORKER_THREADS", std::max<long>(hardware_threads, SERVER_MIN_WORKERS));
+    size_t max_queued = getEnvInt("WALLET_MAX_QUEUED", worker_threads * SERVER_QUEUE_PER_WORKER);
+    size_t max_streams = getEnvInt("WALLET_MAX_STREAMS", SERVER_MAX_STREAMS);
+    worker_threads = std::max<size_t>(worker_threads, 1);
+    max_queued = std::max<size_t>(max_queued, 1);
+    srv.new_task_queue = [worker_threads, max_queued, max_streams] {
+        return new WorkerPool(worker_threads, max_queued, max_streams);
+    };
+    LOG_INFO("Worker pool: %zu threads, %zu queued connections, %zu streams", worker_threads, max_queued, max_streams);
+
+    // Keep-alive connections hold a worker, cap how long and how many requests they get
+    srv.set_keep_alive_max_count(getEnvInt("WALLET_KEEPALIVE_MAX_REQUESTS", SERVER_KEEPALIVE_MAX));
+    srv.set_keep_alive_timeout(getEnvInt("WALLET_KEEPALIVE_TIMEOUT_SEC", SERVER_KEEPALIVE_TIMEOUT_SEC));
+
+    // Responses are written as headers and body separately, don't let Nagle hold the body back
+    srv.set_tcp_nodelay(true);
+
+    std::string retry_after = std::to_string(getEnvInt("WALLET_RETRY_AFTER_SEC", SERVER_RETRY_AFTER_SEC));
+    srv.set_pre_routing_handler([retry_after](const httplib::Request& req, httplib::Response& res) {
+        // Probes and scrapes are cheap and most useful while overloaded
+        if (!isSheddingThread() || req.path == "/health" || req.path == "/metrics") {
+            return httplib::Server::HandlerResponse::Unhandled;
+        }
+        res.status = 503;
+        res.set_header("Retry-After", retry_after);
+        json error_response;
+        error_response["error"] = "Server busy";
+        error_response["message"] = "Too many requests in progress, retry later";
+        sendJson(req, res, error_response);
+        return httplib::Server::HandlerResponse::Handled;
+    });
+
+    // SIGHUP reloads the API keys, SIGINT/SIGTERM stop the server gracefully
+    // so buffered logs and pending writes are flushed
+    std::thread signal_thread([&srv, handled_signals] {
+        for (;;) {
+            int signal_number = 0;
+            sigwait(&handled_signals, &signal_number);
+            if (signal_number == SIGHUP) {
+                LOG_INFO("Received SIGHUP, reloading API keys");
+                if (!reloadApiKeys()) {
+                    LOG_ERROR("API key reload failed, keeping the current keys");
+                }
+                continue;
+            }
+            LOG_INFO("Received signal %d, shutting down", signal_number);
+            // Streams would otherwise keep their threads until the next heartbeat
+            streamHub().close();
+            srv.stop();
+            return;
+        }
+    });
+    signal_thread.detach();
     
     // GET /health endpoint
-    srv.Get("/health", [](const httplib::Request&, httplib::Response& res) {
-        res.set_content("{\"status\":\"ok\",\"message\":\"Currency Wallet API\"}", "application/json");
-    });
+    srv.Get("/health", instrumented("GET", "/health", [](const httplib::Request& req, httplib::Response& res) {
+        sendJson(req, res, json{{"status", "ok"}, {"message", "Currency Wallet API"}});
+    }));
 
     // GET / endpoint
-    srv.Get("/", [](const httplib::Request&, httplib::Response& res) {
-        res.set_content("{\"status\":\"ok\",\"message\":\"Currency Wallet API\"}", "application/json");
-    });
+    srv.Get("/", instrumented("GET", "/", [](const httplib::Request& req, httplib::Response& res) {
+        sendJson(req, res, json{{"status", "ok"}, {"message", "Currency Wallet API"}});
+    }));
     
     // POST /wallet/add endpoint
-    srv.Post("/wallet/add", [](const httplib::Request& req, httplib::Response& res) {
-        std::cout << "POST /wallet/add" << std::endl;
+    srv.Post("/wallet/add", instrumented("POST", "/wallet/add", [](const httplib::Request& req, httplib::Response& res) {
+        LOG_DEBUG("POST /wallet/add");
+        handleWalletMutation(req, res, false);
+    }));
+
+    // POST /wallet/sub endpoint
+    srv.Post("/wallet/sub", instrumented("POST", "/wallet/sub", [](const httplib::Request& req, httplib::Response& res) {
+        LOG_DEBUG("POST /wallet/sub");
+        handleWalletMutation(req, res, true);
+    }));
+
+    // POST /wallet/batch endpoint
+    srv.Post("/wallet/batch", instrumented("POST", "/wallet/batch", [](const httplib::Request& req, httplib::Response& res) {
+        LOG_DEBUG("POST /wallet/batch");
 
         // Authenticate request
         std::string user_id = authenticateRequest(req, res);
         if (user_id.empty()) {
-            return;  
-        }
-
-        // Load userss wallet if it doesn't exist
-        if (user_wallets.find(user_id) == user_wallets.end()) {
-            user_wallets[user_id] = std::map<std::string, double>();
-            loadWalletFromDB(user_id, user_wallets[user_id]);
+            return;
         }
 
         json req_data;
-        
+
         // Parse JSON with error handling
         try {
             req_data = json::parse(req.body);
@@ -60,65 +481,132 @@ int main() {
             json error_response;
             error_response["error"] = "Invalid JSON";
             error_response["details"] = e.what();
-            res.set_content(error_response.dump(2), "application/json");
+            sendJson(req, res, error_response);
             return;
         }
 
-        // Check if the fields exist
-        if(!req_data.contains("currency") || !req_data.contains("amount")) {
+        // Check operations array
+        if (!req_data.is_object() || !req_data.contains("operations") || !req_data["operations"].is_array() ||
+            req_data["operations"].empty()) {
             res.status = 400;
             json error_response;
             error_response["error"] = "Missing required fields";
-            error_response["required"] = {"currency", "amount"};
-            res.set_content(error_response.dump(2), "application/json");
+            error_response["required"] = {"operations"};
+            sendJson(req, res, error_response);
             return;
         }
 
-        std::string currency = req_data["currency"];
-        double amount = req_data["amount"];
-
-        // Check if amount is bigger than 0
-        if(amount <= 0) {
+        const json& operations = req_data["operations"];
+        if (operations.size() > WALLET_BATCH_MAX_OPERATIONS) {
             res.status = 400;
             json error_response;
-            error_response["error"] = "Amount must be bigger than 0";
-            error_response["received"] = amount;
-            res.set_content(error_response.dump(2), "application/json");
+            error_response["error"] = "Too many operations";
+            error_response["max"] = WALLET_BATCH_MAX_OPERATIONS;
+            error_response["received"] = operations.size();
+            sendJson(req, res, error_response);
             return;
         }
 
-        // Check 3-letter currency code (ISO 4217 standard)
-        if (currency.length() != 3) {
-            res.status = 400;
+        // Validate every operation before touching the wallet
+        std::vector<WalletOperation> ops;
+        std::vector<bool> is_sub;
+        for (size_t i = 0; i < operations.size(); i++) {
+            const json& item = operations[i];
             json error_response;
-            error_response["error"] = "Currency code must be 3 characters";
-            error_response["received"] = currency;
-            res.set_content(error_response.dump(2), "application/json");
-            return;
-        }
 
-        // In case it is not uppercase, convert
-        std::transform(currency.begin(), currency.end(), currency.begin(), ::toupper);
+            std::string type = (item.is_object() && item.contains("op") && item["op"].is_string()) ? item["op"].get<std::string>() : "";
+            if (type != "add" && type != "sub") {
+                error_response["error"] = "Operation must be add or sub";
+                error_response["index"] = i;
+                res.status = 400;
+                sendJson(req, res, error_response);
+                return;
+            }
 
-        user_wallets[user_id][currency] += amount;
+            WalletOperation op;
+            if (!validateWalletOperation(item, op, error_response)) {
+                error_response["index"] = i;
+                res.status = 400;
+                sendJson(req, res, error_response);
+                return;
+            }
+            ops.push_back(op);
+            is_sub.push_back(type == "sub");
+        }
 
-        // Save to database
-        if (!saveCurrencyToDB(user_id, currency, user_wallets[user_id][currency])) {
-            std::cerr << "Warning: Failed to save to database" << std::endl;
+        json error_response;
+        bool applied = false;
+        json balances = json::array();
+
+        // All or nothing under the user's lock, the store saves the result in one transaction
+        WalletUpdate result = wallet_store.update(user_id, [&](Balances& wallet) {
+            // Runs again if another process changed the wallet in between
+            error_response = json();
+            applied = false;
+            balances = json::array();
+            Balances updated = wallet;
+
+            for (size_t i = 0; i < ops.size(); i++) {
+                CurrencyCode code = ops[i].code;
+                double amount = ops[i].amount;
+
+                if (is_sub[i]) {
+                    double* balance = updated.find(code);
+                    if (balance == nullptr) {
+                        error_response["error"] = "No such currency in wallet";
+                        error_response["currency"] = code.str();
+                        error_response["index"] = i;
+                        return;
+                    }
+                    if (*balance < amount) {
+                        error_response["error"] = "Not enough funds";
+                        error_response["currency"] = code.str();
+                        error_response["available"] = *balance;
+                        error_response["requested"] = amount;
+                        error_response["index"] = i;
+                        return;
+                    }
+                    *balance -= amount;
+
+                    // Delete if zero (or close to zero due to double type amount)
+                    if (*balance <= 0.01) {
+                        updated.erase(code);
+                    }
+                } else {
+                    updated[code] += amount;
+                }
+            }
+            applied = true;
+
+            wallet = std::move(updated);
+            for (const Balances::Entry& entry : wallet) {
+                json item;
+                item["currency"] = entry.code.str();
+                item["amount"] = roundTo2Decimals(entry.amount);
+                balances.push_back(item);
+            }
+        });
+        if (setWalletUpdateError(req, res, result)) {
+            return;
+        }
+
+        if (!applied) {
+            res.status = 400;
+            sendJson(req, res, error_response);
+            return;
         }
 
         json response;
-        response["message"] = "Currency added";
-        response["currency"] = currency;
-        response["amount"] = roundTo2Decimals(amount);
-        response["total"] = roundTo2Decimals(user_wallets[user_id][currency]);
+        response["message"] = "Batch applied";
+        response["operations"] = ops.size();
+        response["wallet"] = balances;
 
-        res.set_content(response.dump(2), "application/json");
-    });
+        sendJson(req, res, response);
+    }));
 
-    // POST /wallet/sub endpoint
-    srv.Post("/wallet/sub", [](const httplib::Request& req, httplib::Response& res) {
-        std::cout << "POST /wallet/sub" << std::endl;
+    // GET /wallet endpoint
+    srv.Get("/wallet", instrumented("GET", "/wallet", [](const httplib::Request& req, httplib::Response& res) {
+        LOG_DEBUG("GET /wallet");
 
         // Authenticate request
         std::string user_id = authenticateRequest(req, res);
@@ -126,171 +614,338 @@ int main() {
             return;  
         }
 
-        // Load userss wallet if it doesn't exist
-        if (user_wallets.find(user_id) == user_wallets.end()) {
-            user_wallets[user_id] = std::map<std::string, double>();
-            loadWalletFromDB(user_id, user_wallets[user_id]);
-        }
-
-        json req_data;
-        
-        // Parse JSON with error handling
-        try{
-            req_data = json::parse(req.body);
-        } catch(const json::parse_error& e) {
-            res.status = 400;
+        // Current NBP rates, shared snapshot (no copy)
+        std::shared_ptr<const RateSnapshot> rate_snapshot = getRateSnapshot();
+        if (!rate_snapshot || rate_snapshot->rates.empty()) {
+            res.status = 500;
             json error_response;
-            error_response["error"] = "Invalid JSON";
-            error_response["details"] = e.what();
-            res.set_content(error_response.dump(2), "application/json");
+            error_response["error"] = "Failed to fetch exchange rates from NBP";
+            sendJson(req, res, error_response);
             return;
         }
         
-        // Check if the fields exist
-        if(!req_data.contains("currency") || !req_data.contains("amount")) {
-            res.status = 400;
-            json error_response;
-            error_response["error"] = "Missing required fields";
-            error_response["required"] = {"currency", "amount"};
-            res.set_content(error_response.dump(2), "application/json");
+        // Each encoding is cached and tagged separately
+        std::string variant = responseVariant(req);
+        std::string cache_key = user_id + "/" + variant;
+        std::string if_none_match = req.get_header_value("If-None-Match");
+        std::string etag;
+        bool not_modified = false;
+        std::shared_ptr<const CachedResponse> cached;
+        bool needs_fallback = false;
+
+        auto respond = [&](const Balances& wallet, uint64_t version) {
+            // Currencies outside Tables C and A: look them up in Table B (outside the wallet lock) and retry
+            if (!rate_snapshot->fallback_checked) {
+                for (const Balances::Entry& entry : wallet) {
+                    if (!rate_snapshot->rates.has(entry.code)) {
+                        needs_fallback = true;
+                        return;
+                    }
+                }
+            }
+
+            // Same wallet version and rate snapshot always produce the same body
+            etag = makeWalletETag(version, rate_snapshot->id, variant);
+            if (etagMatches(if_none_match, etag)) {
+                not_modified = true;
+                return;
+            }
+
+            cached = wallet_responses.get(cache_key);
+            if (cached && cached->etag == etag) {
+                return;
+            }
+
+            json response;
+            {
+                TRACE_SPAN("wallet.value");
+                response = buildWalletResponse(wallet, rate_snapshot->rates);
+            }
+            cached = std::make_shared<const CachedResponse>(CachedResponse{etag, encodeResponse(req, response)});
+            wallet_responses.put(cache_key, cached);
+        };
+        bool loaded = wallet_store.read(user_id, respond);
+        if (loaded && needs_fallback) {
+            rate_snapshot = resolveMissingRates(rate_snapshot);
+            needs_fallback = false;
+            loaded = wallet_store.read(user_id, respond);
+        }
+        if (!loaded) {
+            setWalletLoadError(req, res);
             return;
         }
 
-        std::string currency = req_data["currency"];
-        double amount = req_data["amount"];
+        // Clients must revalidate, the ETag makes that cheap
+        res.set_header("ETag", etag);
+        res.set_header("Cache-Control", "no-cache");
 
-        // Check if amount is bigger than 0
-        if(amount <= 0) {
-            res.status = 400;
-            json error_response;
-            error_response["error"] = "Amount must be bigger than 0";
-            error_response["received"] = amount;
-            res.set_content(error_response.dump(2), "application/json");
+        if (not_modified) {
+            res.status = 304;
+            res.set_header("Vary", "Accept, Accept-Encoding");
             return;
         }
+        setEncodedContent(res, cached->encoded);
+    }));
 
-        // Check 3-letter currency code (ISO 4217 standard)
-        if (currency.length() != 3) {
-            res.status = 400;
+    // GET /wallet/stream endpoint: Server-Sent Events with the valued wallet, sent when balances or rates change
+    srv.Get("/wallet/stream", instrumented("GET", "/wallet/stream", [](const httplib::Request& req, httplib::Response& res) {
+        LOG_DEBUG("GET /wallet/stream");
+
+        // Authenticate request
+        std::string user_id = authenticateRequest(req, res);
+        if (user_id.empty()) {
+            return;
+        }
+
+        // The stream keeps this thread, the pool starts another worker in its place
+        if (!releaseWorkerForStream()) {
+            res.status = 503;
+            res.set_header("Retry-After", std::to_string(SERVER_RETRY_AFTER_SEC));
             json error_response;
-            error_response["error"] = "Currency code must be 3 characters";
-            error_response["received"] = currency;
-            res.set_content(error_response.dump(2), "application/json");
+            error_response["error"] = "Server busy";
+            error_response["message"] = "Too many open streams, retry later";
+            sendJson(req, res, error_response);
             return;
         }
 
-        // In case it is not uppercase, convert
-        std::transform(currency.begin(), currency.end(), currency.begin(), ::toupper);
+        struct StreamState {
+            std::shared_ptr<StreamSubscription> subscription;
+            std::string last_data;
+        };
+        auto state = std::make_shared<StreamState>();
+        state->subscription = streamHub().subscribe(user_id);
+
+        res.set_header("Cache-Control", "no-cache");
+        res.set_chunked_content_provider("text/event-stream",
+            [state](size_t, httplib::DataSink& sink) {
+                switch (state->subscription->wait(std::chrono::seconds(STREAM_HEARTBEAT_SEC))) {
+                    case StreamSubscription::Wake::Closed:
+                        sink.done();
+                        return true;
+                    case StreamSubscription::Wake::Timeout: {
+                        static const char heartbeat[] = ": ping\n\n";
+                        return sink.write(heartbeat, sizeof(heartbeat) - 1);
+                    }
+                    case StreamSubscription::Wake::Changed:
+                        break;
+                }
+                std::string event;
+                if (!buildWalletEvent(state->subscription->userId(), state->last_data, event)) {
+                    return true;
+                }
+                return sink.write(event.data(), event.size());
+            },
+            [state](bool) { streamHub().unsubscribe(state->subscription); });
+    }));
+
+    // GET /wallet/history?from=YYYY-MM-DD&to=YYYY-MM-DD endpoint
+    srv.Get("/wallet/history", instrumented("GET", "/wallet/history", [](const httplib::Request& req, httplib::Response& res) {
+        LOG_DEBUG("GET /wallet/history");
 
-        // Check if there is the reuested currency in wallet
-        if (user_wallets[user_id].find(currency) == user_wallets[user_id].end()) {
-            res.status = 400;
-            json error_response;
-            error_response["error"] = "No such currency in wallet";
-            error_response["currency"] = currency;
-            res.set_content(error_response.dump(2), "application/json");
+        // Authenticate request
+        std::string user_id = authenticateRequest(req, res);
+        if (user_id.empty()) {
             return;
         }
 
-        // Check if there is enough funds in wallet
-        if (user_wallets[user_id][currency] < amount) {
+        // Defaults to the last RATE_HISTORY_DEFAULT_DAYS days, nothing after today
+        int32_t today = currentDay();
+        int32_t to_day = today;
+        int32_t from_day = 0;
+        bool valid = !req.has_param("to") || parseDate(req.get_param_value("to"), to_day);
+        to_day = std::min(to_day, today);
+        if (valid) {
+            from_day = to_day - RATE_HISTORY_DEFAULT_DAYS;
+            valid = !req.has_param("from") || parseDate(req.get_param_value("from"), from_day);
+        }
+        if (!valid || from_day > to_day || to_day - from_day >= RATE_HISTORY_MAX_DAYS) {
             res.status = 400;
             json error_response;
-            error_response["error"] = "Not enough funds";
-            error_response["currency"] = currency;
-            error_response["available"] = user_wallets[user_id][currency];
-            error_response["requested"] = amount;
-            res.set_content(error_response.dump(2), "application/json");
+            error_response["error"] = "Invalid date range";
+            error_response["details"] = "from and to must be YYYY-MM-DD, from <= to, at most " +
+                                        std::to_string(RATE_HISTORY_MAX_DAYS) + " days";
+            sendJson(req, res, error_response);
             return;
         }
 
-        user_wallets[user_id][currency] -= amount;
-
-        // Save the new amount
-        double new_amount = user_wallets[user_id][currency];
-
-        // Delete if zero (or close to zero due to double type amount)
-        if (new_amount <= 0.01) {
-            user_wallets[user_id].erase(currency);
-            if (!deleteCurrencyFromDB(user_id, currency)) {
-                std::cerr << "Failed to delete from database" << std::endl;
-            }
-        } else {
-            // Save updated amount
-            if (!saveCurrencyToDB(user_id, currency, new_amount)) {
-                std::cerr << "Failed to save to database" << std::endl;
-            }
+        Balances wallet;
+        bool loaded = wallet_store.read(user_id, [&wallet](const Balances& balances, uint64_t) {
+            wallet = balances;
+        });
+        if (!loaded) {
+            setWalletLoadError(req, res);
+            return;
         }
 
-        json response;
-        response["message"] = "Currency subsracted";
-        response["currency"] = currency;
-        response["amount"] = roundTo2Decimals(amount);
-        response["total"] = roundTo2Decimals(new_amount);
-
-        res.set_content(response.dump(2), "application/json");
-    });
+        std::shared_ptr<const RateHistorySnapshot> history = rateHistory().ensure(from_day, to_day);
+        if (!history) {
+            res.status = 500;
+            json error_response;
+            error_response["error"] = "Failed to fetch exchange rates from NBP";
+            sendJson(req, res, error_response);
+            return;
+        }
 
-    // GET /wallet endpoint
-    srv.Get("/wallet", [](const httplib::Request& req, httplib::Response& res) {
-        std::cout << "GET /wallet" << std::endl;
+        WalletSeries series;
+        {
+            TRACE_SPAN("history.value");
+            valueWalletSeries(*history, wallet, from_day, to_day, series);
+        }
 
-        // Authenticate request
-        std::string user_id = authenticateRequest(req, res);
-        if (user_id.empty()) {
-            return;  
+        json points = json::array();
+        for (size_t i = 0; i < series.days.size(); i++) {
+            points.push_back({{"date", formatDate(series.days[i])}, {"total_pln", roundTo2Decimals(series.totals[i])}});
+        }
+        json currencies = json::array();
+        for (const Balances::Entry& entry : wallet) {
+            currencies.push_back(entry.code.str());
+        }
+        json missing = json::array();
+        for (CurrencyCode code : series.missing) {
+            missing.push_back(code.str());
         }
 
-        // Load userss wallet if it doesn't exist
-        if (user_wallets.find(user_id) == user_wallets.end()) {
-            user_wallets[user_id] = std::map<std::string, double>();
-            loadWalletFromDB(user_id, user_wallets[user_id]);
+        json response;
+        response["from"] = formatDate(from_day);
+        response["to"] = formatDate(to_day);
+        response["currencies"] = currencies;
+        response["missing_rates"] = missing;
+        response["series"] = points;
+        sendJson(req, res, response);
+    }));
+
+    // GET /admin/exposure endpoint: holdings per currency over all users, valued with current rates
+    srv.Get("/admin/exposure", instrumented("GET", "/admin/exposure", [](const httplib::Request& req, httplib::Response& res) {
+        LOG_DEBUG("GET /admin/exposure");
+
+        if (!authenticateAdmin(req, res)) {
+            return;
         }
 
-        // Fetch all NBP Table C rates at once
-        std::map<std::string, double> nbp_rates = fetchAllNBPRates();
-        if (nbp_rates.empty()) {
+        std::shared_ptr<const RateSnapshot> rate_snapshot = getRateSnapshot();
+        if (!rate_snapshot || rate_snapshot->rates.empty()) {
             res.status = 500;
             json error_response;
             error_response["error"] = "Failed to fetch exchange rates from NBP";
-            res.set_content(error_response.dump(2), "application/json");
+            sendJson(req, res, error_response);
             return;
         }
-        
-        json wallet_array = json::array();
-        double total_pln = 0.0;
 
-        for(auto& [currency, amount] : user_wallets[user_id]) {
-            // Check if rate exists for this currency
-            if (nbp_rates.find(currency) == nbp_rates.end()) {
-                std::cerr << "No NBP rate found: " << currency << std::endl;
-                // Skip currencies that are not in NBP Table C
-                continue;  
+        std::vector<CurrencyExposure> totals = exposure().totals();
+        std::sort(totals.begin(), totals.end(),
+                  [](const CurrencyExposure& a, const CurrencyExposure& b) { return a.code < b.code; });
+        for (const CurrencyExposure& total : totals) {
+            if (!rate_snapshot->rates.has(total.code)) {
+                rate_snapshot = resolveMissingRates(rate_snapshot);
+                break;
             }
+        }
 
-            double rate = nbp_rates[currency];
-            double pln_value = amount * rate;
-            total_pln += pln_value;
-            
+        json currencies = json::array();
+        json missing = json::array();
+        double total_pln = 0.0;
+        for (const CurrencyExposure& total : totals) {
             json item;
-            item["currency"] = currency;
-            item["amount"] = roundTo2Decimals(amount);
-            item["rate"] = roundTo2Decimals(rate);
-            item["pln_value"] = roundTo2Decimals(pln_value);
-            
-            wallet_array.push_back(item);
+            item["currency"] = total.code.str();
+            item["amount"] = roundTo2Decimals(total.amount);
+            item["holders"] = total.holders;
+
+            double rate = rate_snapshot->rates.get(total.code);
+            if (rate > 0.0) {
+                double pln_value = total.amount * rate;
+                total_pln += pln_value;
+                item["rate"] = roundTo2Decimals(rate);
+                item["pln_value"] = roundTo2Decimals(pln_value);
+            } else {
+                missing.push_back(total.code.str());
+            }
+            currencies.push_back(item);
         }
 
         json response;
-        response["wallet"] = wallet_array;
+        response["currencies"] = currencies;
+        response["missing_rates"] = missing;
         response["total_pln"] = roundTo2Decimals(total_pln);
-        res.set_content(response.dump(2), "application/json");
+        response["rates_fetched_at"] = static_cast<int64_t>(rate_snapshot->fetched_at);
+        sendJson(req, res, response);
+    }));
+
+    // GET /metrics endpoint (Prometheus text format)
+    srv.Get("/metrics", [](const httplib::Request&, httplib::Response& res) {
+        res.set_content(metrics().render(), "text/plain; version=0.0.4");
     });
 
-    
+    metrics().callbackGauge("wallet_api_keys", "API keys in the current table",
+                            [] { return static_cast<double>(apiKeyCount()); });
+    metrics().callbackGauge("wallet_stream_subscribers", "Open /wallet/stream connections",
+                            [] { return static_cast<double>(streamHub().size()); });
+    metrics().callbackGauge("wallet_wallets_resident", "Wallets held in memory",
+                            [] { return static_cast<double>(wallet_store.size()); });
+    metrics().callbackGauge("wallet_store_capacity", "Most wallets held in memory, 0 for no limit",
+                            [] { return static_cast<double>(wallet_store.stats().capacity); });
+    metrics().callbackGauge("wallet_store_hit_ratio", "Share of wallet lookups served from memory",
+                            [] {
+                                WalletStoreStats stats = wallet_store.stats();
+                                uint64_t lookups = stats.hits + stats.misses;
+                                return lookups == 0 ? 0.0 : static_cast<double>(stats.hits) / lookups;
+                            });
+
+    // Bound memory: cold wallets are evicted and read back from the database on their next use
+    // The journal engine holds every wallet itself, there the cap only bounds the store's copies
+    int max_wallets = getEnvInt("WALLET_CACHE_MAX_WALLETS", 0);
+    if (max_wallets > 0 && storage_engine == "journal") {
+        LOG_WARN("WALLET_CACHE_MAX_WALLETS does not bound memory with the journal engine, it keeps every wallet resident");
+    }
+    wallet_store.setCapacity(static_cast<size_t>(max_wallets));
+    wallet_store.setEvictionListener([](const std::vector<std::string>& user_ids) {
+        static const std::vector<std::string> variants = allResponseVariants();
+        for (const std::string& user_id : user_ids) {
+            for (const std::string& variant : variants) {
+                wallet_responses.erase(user_id + "/" + variant);
+            }
+        }
+    });
+
+    // Keep NBP rates fresh in the background
+    // Warm start: serve saved rates right away, the refresher renews them in the background
+    loadPersistedRates();
+    rateHistory().load();
+
+    // Load every wallet in one table scan instead of one query per user on first request
+    if (getEnvInt("WALLET_PRELOAD", 1) != 0) {
+        size_t preloaded = 0;
+        bool scanned = loadAllWalletsFromDB([&preloaded](const std::string& user_id, Balances& wallet, int64_t version) {
+            if (wallet_store.preload(user_id, wallet, version)) {
+                preloaded++;
+            }
+        });
+        if (scanned) {
+            if (wallet_store.stats().capacity != 0) {
+                LOG_INFO("Preloaded %zu wallets (cache capacity %zu)", preloaded, wallet_store.stats().capacity);
+            } else {
+                LOG_INFO("Preloaded %zu wallets", preloaded);
+            }
+        } else {
+            LOG_WARN("Wallet preload failed, wallets will be loaded on first use");
+        }
+    }
+
+    // Resident wallets are reloaded when another process writes them
+    int sync_interval_ms = static_cast<int>(getEnvInt("WALLET_SYNC_INTERVAL_MS", DB_SYNC_INTERVAL_MS));
+    if (!startChangeFeed(synced_version, sync_interval_ms, onDatabaseChanges)) {
+        LOG_WARN("Change feed failed to start, writes by other processes will only be noticed on conflict");
+    }
+
+    startRateRefresher();
+
     // Start server
-    std::cout << "Server listening on port 8080" << std::endl;
-    srv.listen("0.0.0.0", 8080);
-    
+    int port = static_cast<int>(getEnvInt("WALLET_PORT", 8080));
+    LOG_INFO("Server listening on port %d", port);
+    srv.listen("0.0.0.0", port);
+
+    stopRateRefresher();
+    closeDatabase();
+    stopTracer();
+    stopLogger();
     return 0;
 }
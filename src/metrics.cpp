@@ -0,0 +1,173 @@
+#include "metrics.h"
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+Histogram::Histogram(std::vector<double> bounds)
+    : bounds_(std::move(bounds)), counts_(new std::atomic<uint64_t>[bounds_.size() + 1]) {
+    std::sort(bounds_.begin(), bounds_.end());
+    for (size_t i = 0; i <= bounds_.size(); i++) {
+        counts_[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void Histogram::observe(double value) {
+    size_t i = std::lower_bound(bounds_.begin(), bounds_.end(), value) - bounds_.begin();
+    counts_[i].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+
+    double current = sum_.load(std::memory_order_relaxed);
+    while (!sum_.compare_exchange_weak(current, current + value, std::memory_order_relaxed)) {
+    }
+}
+
+const std::vector<double>& latencyBuckets() {
+    static const std::vector<double> buckets = {
+        0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0
+    };
+    return buckets;
+}
+
+MetricsRegistry::Series& MetricsRegistry::series(const std::string& name, const std::string& help,
+                                                 Type type, const MetricLabels& labels) {
+    Family* family = nullptr;
+    for (auto& f : families_) {
+        if (f->name == name) {
+            family = f.get();
+            break;
+        }
+    }
+    if (!family) {
+        families_.push_back(std::unique_ptr<Family>(new Family{name, help, type, {}}));
+        family = families_.back().get();
+    }
+
+    // Same name and labels return the existing series
+    for (auto& s : family->series) {
+        if (s->labels == labels) {
+            return *s;
+        }
+    }
+    family->series.push_back(std::unique_ptr<Series>(new Series{labels, nullptr, nullptr, nullptr, nullptr}));
+    return *family->series.back();
+}
+
+Counter& MetricsRegistry::counter(const std::string& name, const std::string& help, const MetricLabels& labels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Series& s = series(name, help, Type::Counter, labels);
+    if (!s.counter) {
+        s.counter.reset(new Counter());
+    }
+    return *s.counter;
+}
+
+Gauge& MetricsRegistry::gauge(const std::string& name, const std::string& help, const MetricLabels& labels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Series& s = series(name, help, Type::Gauge, labels);
+    if (!s.gauge) {
+        s.gauge.reset(new Gauge());
+    }
+    return *s.gauge;
+}
+
+Histogram& MetricsRegistry::histogram(const std::string& name, const std::string& help, const MetricLabels& labels,
+                                      const std::vector<double>& bounds) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Series& s = series(name, help, Type::Histogram, labels);
+    if (!s.histogram) {
+        s.histogram.reset(new Histogram(bounds));
+    }
+    return *s.histogram;
+}
+
+void MetricsRegistry::callbackGauge(const std::string& name, const std::string& help, std::function<double()> fn,
+                                    const MetricLabels& labels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Series& s = series(name, help, Type::Gauge, labels);
+    s.callback = std::move(fn);
+}
+
+// {a="1",b="2"} plus an optional extra label (used for "le")
+static std::string formatLabels(const MetricLabels& labels, const std::string& extra_name = "",
+                                const std::string& extra_value = "") {
+    if (labels.empty() && extra_name.empty()) {
+        return "";
+    }
+
+    std::string out = "{";
+    bool first = true;
+    auto append = [&](const std::string& name, const std::string& value) {
+        if (!first) {
+            out += ',';
+        }
+        first = false;
+        out += name;
+        out += "=\"";
+        for (char c : value) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+            }
+            out += (c == '\n') ? ' ' : c;
+        }
+        out += '"';
+    };
+
+    for (const auto& [name, value] : labels) {
+        append(name, value);
+    }
+    if (!extra_name.empty()) {
+        append(extra_name, extra_value);
+    }
+    out += '}';
+    return out;
+}
+
+static std::string formatValue(double value) {
+    if (std::isinf(value)) {
+        return value > 0 ? "+Inf" : "-Inf";
+    }
+    std::ostringstream out;
+    out.precision(10);
+    out << value;
+    return out.str();
+}
+
+std::string MetricsRegistry::render() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::ostringstream out;
+
+    for (const auto& family : families_) {
+        const char* type = family->type == Type::Counter ? "counter"
+                         : family->type == Type::Gauge ? "gauge" : "histogram";
+        out << "# HELP " << family->name << ' ' << family->help << '\n';
+        out << "# TYPE " << family->name << ' ' << type << '\n';
+
+        for (const auto& s : family->series) {
+            if (s->counter) {
+                out << family->name << formatLabels(s->labels) << ' ' << s->counter->value() << '\n';
+            } else if (s->gauge) {
+                out << family->name << formatLabels(s->labels) << ' ' << s->gauge->value() << '\n';
+            } else if (s->callback) {
+                out << family->name << formatLabels(s->labels) << ' ' << formatValue(s->callback()) << '\n';
+            } else if (s->histogram) {
+                const Histogram& h = *s->histogram;
+                uint64_t cumulative = 0;
+                for (size_t i = 0; i < h.bounds().size(); i++) {
+                    cumulative += h.bucketCount(i);
+                    out << family->name << "_bucket" << formatLabels(s->labels, "le", formatValue(h.bounds()[i]))
+                        << ' ' << cumulative << '\n';
+                }
+                cumulative += h.bucketCount(h.bounds().size());
+                out << family->name << "_bucket" << formatLabels(s->labels, "le", "+Inf") << ' ' << cumulative << '\n';
+                out << family->name << "_sum" << formatLabels(s->labels) << ' ' << formatValue(h.sum()) << '\n';
+                out << family->name << "_count" << formatLabels(s->labels) << ' ' << h.count() << '\n';
+            }
+        }
+    }
+    return out.str();
+}
+
+MetricsRegistry& metrics() {
+    static MetricsRegistry registry;
+    return registry;
+}
@@ -0,0 +1,118 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <utility>
+#include <cstdint>
+
+// Label pairs, e.g. {{"route", "/wallet"}, {"method", "GET"}}
+using MetricLabels = std::vector<std::pair<std::string, std::string>>;
+
+// Monotonic counter, one relaxed atomic add per increment
+class Counter {
+public:
+    void inc(uint64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value_{0};
+};
+
+// Value that can go up and down
+class Gauge {
+public:
+    void set(int64_t v) { value_.store(v, std::memory_order_relaxed); }
+    void inc(int64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+    void dec(int64_t n = 1) { value_.fetch_sub(n, std::memory_order_relaxed); }
+    int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> value_{0};
+};
+
+// Fixed-bucket histogram with atomic bucket counters
+class Histogram {
+public:
+    explicit Histogram(std::vector<double> bounds);
+
+    void observe(double value);
+
+    const std::vector<double>& bounds() const { return bounds_; }
+    // Non-cumulative count of bucket i, the last bucket is +Inf
+    uint64_t bucketCount(size_t i) const { return counts_[i].load(std::memory_order_relaxed); }
+    uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+    double sum() const { return sum_.load(std::memory_order_relaxed); }
+
+private:
+    std::vector<double> bounds_;
+    std::unique_ptr<std::atomic<uint64_t>[]> counts_;
+    std::atomic<uint64_t> count_{0};
+    std::atomic<double> sum_{0.0};
+};
+
+// Default latency buckets in seconds, 0.5 ms .. 10 s
+const std::vector<double>& latencyBuckets();
+
+// Records the elapsed seconds into a histogram when leaving scope
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Histogram& histogram)
+        : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() {
+        histogram_.observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count());
+    }
+
+private:
+    Histogram& histogram_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Owns all metrics and renders them in Prometheus text format
+// Registering takes a lock, updating a registered metric never does
+class MetricsRegistry {
+public:
+    Counter& counter(const std::string& name, const std::string& help, const MetricLabels& labels = {});
+    Gauge& gauge(const std::string& name, const std::string& help, const MetricLabels& labels = {});
+    Histogram& histogram(const std::string& name, const std::string& help, const MetricLabels& labels = {},
+                         const std::vector<double>& bounds = latencyBuckets());
+
+    // Gauge evaluated on every scrape, for values owned by other components
+    void callbackGauge(const std::string& name, const std::string& help, std::function<double()> fn,
+                       const MetricLabels& labels = {});
+
+    std::string render() const;
+
+private:
+    enum class Type { Counter, Gauge, Histogram };
+
+    struct Series {
+        MetricLabels labels;
+        std::unique_ptr<Counter> counter;
+        std::unique_ptr<Gauge> gauge;
+        std::unique_ptr<Histogram> histogram;
+        std::function<double()> callback;
+    };
+
+    struct Family {
+        std::string name;
+        std::string help;
+        Type type;
+        std::vector<std::unique_ptr<Series>> series;
+    };
+
+    Series& series(const std::string& name, const std::string& help, Type type, const MetricLabels& labels);
+
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<Family>> families_;
+};
+
+// Process-wide registry
+MetricsRegistry& metrics();
+
+#endif // METRICS_H
@@ -1,10 +1,65 @@
 #include "nbp_client.h"
 #include <curl/curl.h>
-#include <iostream>
+#include "logger.h"
+#include "metrics.h"
+#include "tracing.h"
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <fstream>
+#include <cstdio>
+#include <cctype>
 #include "utils.h"
+#include "stream_hub.h"
 
 static NBPRateCache global_cache;
 
+static Histogram& fetch_table_a_seconds = metrics().histogram(
+    "wallet_nbp_fetch_seconds", "NBP API request latency", {{"table", "A"}});
+static Histogram& fetch_table_c_seconds = metrics().histogram(
+    "wallet_nbp_fetch_seconds", "NBP API request latency", {{"table", "C"}});
+static Counter& fetch_table_a_errors = metrics().counter(
+    "wallet_nbp_fetch_errors_total", "Failed NBP API requests", {{"table", "A"}});
+static Counter& fetch_table_c_errors = metrics().counter(
+    "wallet_nbp_fetch_errors_total", "Failed NBP API requests", {{"table", "C"}});
+static Histogram& fetch_table_b_seconds = metrics().histogram(
+    "wallet_nbp_fetch_seconds", "NBP API request latency", {{"table", "B"}});
+static Counter& fetch_table_b_errors = metrics().counter(
+    "wallet_nbp_fetch_errors_total", "Failed NBP API requests", {{"table", "B"}});
+static Histogram& fetch_table_c_range_seconds = metrics().histogram(
+    "wallet_nbp_fetch_seconds", "NBP API request latency", {{"table", "C-range"}});
+static Counter& fetch_table_c_range_errors = metrics().counter(
+    "wallet_nbp_fetch_errors_total", "Failed NBP API requests", {{"table", "C-range"}});
+static Counter& rate_cache_hits = metrics().counter(
+    "wallet_rate_cache_requests_total", "NBPRateCache lookups", {{"result", "hit"}});
+static Counter& rate_cache_misses = metrics().counter(
+    "wallet_rate_cache_requests_total", "NBPRateCache lookups", {{"result", "miss"}});
+static Counter& fallback_lookups = metrics().counter(
+    "wallet_rate_fallback_total", "Wallets with currencies outside Tables A and C", {{"result", "fetched"}});
+static Counter& fallback_shared = metrics().counter(
+    "wallet_rate_fallback_total", "Wallets with currencies outside Tables A and C", {{"result", "shared"}});
+
+// HTTP client settings and libcurl share locks
+static std::mutex config_mutex;
+static NBPClientConfig client_config;
+static std::mutex share_mutexes[CURL_LOCK_DATA_LAST];
+static std::atomic<uint64_t> next_snapshot_id{1};
+
+// Table B lookups for codes missing from a snapshot, one at a time
+static std::mutex fallback_mutex;
+
+// Single-flight state: only one upstream Table C/A refresh at a time
+static std::mutex refresh_mutex;
+static std::condition_variable refresh_cond;
+static bool refresh_in_flight = false;
+
+// Background refresher state
+static std::mutex refresher_mutex;
+static std::condition_variable refresher_cond;
+static bool refresher_stopping = false;
+static std::thread refresher_thread;
+
 // Callback function for libcurl to write data
 static size_t WriteCallback(char* data, size_t size, size_t nmemb, std::string* response_data)
 {
@@ -16,114 +71,168 @@ static size_t WriteCallback(char* data, size_t size, size_t nmemb, std::string*
     return size * nmemb;
 }
 
-double fetchNBPRate(const std::string& currency) {
-    std::string url = "https://api.nbp.pl/api/exchangerates/rates/a/" + currency + "/?format=json";
-    std::string response_data;
+// Share handle locking, libcurl calls these from any thread using the share
+static void shareLock(CURL*, curl_lock_data data, curl_lock_access, void*) {
+    share_mutexes[data % CURL_LOCK_DATA_LAST].lock();
+}
+
+static void shareUnlock(CURL*, curl_lock_data data, void*) {
+    share_mutexes[data % CURL_LOCK_DATA_LAST].unlock();
+}
+
+// One-time libcurl setup. The share handle lives for the whole process,
+// thread-local easy handles may still reference it during shutdown
+static CURLSH* sharedHandle() {
+    static CURLSH* share = [] {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+
+        CURLSH* handle = curl_share_init();
+        if (!handle) {
+            LOG_ERROR("Failed to initialize CURL share handle");
+            return handle;
+        }
+        curl_share_setopt(handle, CURLSHOPT_LOCKFUNC, shareLock);
+        curl_share_setopt(handle, CURLSHOPT_UNLOCKFUNC, shareUnlock);
+        curl_share_setopt(handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        curl_share_setopt(handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+        return handle;
+    }();
+    return share;
+}
+
+// Easy handle reused by every request on this thread, keeps its connection warm
+struct EasyHandle {
+    CURL* curl = nullptr;
     char errorBuffer[CURL_ERROR_SIZE];
-    
-    CURL* curl = curl_easy_init();
-    if (!curl) {
-        std::cerr << "Failed to initialize CURL" << std::endl;
-        return -1.0;
+
+    EasyHandle() {
+        CURLSH* share = sharedHandle();
+        curl = curl_easy_init();
+        if (!curl) {
+            return;
+        }
+
+        NBPClientConfig config = nbpClientConfig();
+        curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errorBuffer);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
+        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, config.connect_timeout_ms);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, config.timeout_ms);
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+        if (config.gzip) {
+            // Empty string: accept every encoding libcurl was built with
+            curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+        }
+        if (share) {
+            curl_easy_setopt(curl, CURLOPT_SHARE, share);
+        }
     }
-    
-    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errorBuffer);
-        
-    CURLcode result;
-    result = curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    if(result != CURLE_OK) {
-        std::cerr << "Failed to set URL: " << errorBuffer << std::endl;
-        curl_easy_cleanup(curl);
-        return -1.0;
+
+    ~EasyHandle() {
+        if (curl) {
+            curl_easy_cleanup(curl);
+        }
     }
+};
 
-    result = curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
+// GET base_url + path, returns false on transport errors or non-2xx status
+// With status_out the caller gets the HTTP status and handles 404 itself
+static bool httpGet(const std::string& path, std::string& response_data, long* status_out = nullptr) {
+    TRACE_SPAN("nbp.http_get");
+    thread_local EasyHandle handle;
+    if (!handle.curl) {
+        LOG_ERROR("Failed to initialize CURL");
+        return false;
+    }
+
+    std::string url = nbpClientConfig().base_url + path;
+    handle.errorBuffer[0] = '\0';
+
+    CURLcode result;
+    result = curl_easy_setopt(handle.curl, CURLOPT_URL, url.c_str());
     if (result != CURLE_OK) {
-        std::cerr << "Failed to set write function: " << errorBuffer << std::endl;
-        curl_easy_cleanup(curl);
-        return -1.0;
+        LOG_ERROR("Failed to set URL: %s", handle.errorBuffer);
+        return false;
     }
 
-    result = curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_data);
+    result = curl_easy_setopt(handle.curl, CURLOPT_WRITEDATA, &response_data);
     if (result != CURLE_OK) {
-        std::cerr << "Failed to set write data: " << errorBuffer << std::endl;
-        curl_easy_cleanup(curl);
-        return -1.0;
+        LOG_ERROR("Failed to set write data: %s", handle.errorBuffer);
+        return false;
     }
 
     // Perform the request
-    result = curl_easy_perform(curl);
+    result = curl_easy_perform(handle.curl);
     if (result != CURLE_OK) {
-        std::cerr << "CURL request failed: " << errorBuffer << std::endl;
-        curl_easy_cleanup(curl);
-        return -1.0;
+        LOG_ERROR("CURL request failed: %s", handle.errorBuffer[0] ? handle.errorBuffer : curl_easy_strerror(result));
+        return false;
     }
 
-    curl_easy_cleanup(curl);
+    long status = 0;
+    curl_easy_getinfo(handle.curl, CURLINFO_RESPONSE_CODE, &status);
+    if (status_out != nullptr) {
+        *status_out = status;
+    }
+    if (status < 200 || status >= 300) {
+        if (status == 404 && status_out != nullptr) {
+            return false;
+        }
+        LOG_ERROR("NBP request failed with HTTP %ld: %s", status, url.c_str());
+        return false;
+    }
+    return true;
+}
+
+void configureNBPClient(const NBPClientConfig& config) {
+    std::lock_guard<std::mutex> lock(config_mutex);
+    client_config = config;
+    // Strip trailing slash so paths can always start with one
+    while (!client_config.base_url.empty() && client_config.base_url.back() == '/') {
+        client_config.base_url.pop_back();
+    }
+}
+
+NBPClientConfig nbpClientConfig() {
+    std::lock_guard<std::mutex> lock(config_mutex);
+    return client_config;
+}
+
+double fetchNBPRate(const std::string& currency) {
+    std::string response_data;
+    {
+        ScopedTimer timer(fetch_table_a_seconds);
+        if (!httpGet("/exchangerates/rates/a/" + currency + "/?format=json", response_data)) {
+            fetch_table_a_errors.inc();
+            return -1.0;
+        }
+    }
 
     // Parse JSON response
     try {
         json nbp_response = json::parse(response_data);
         double rate = nbp_response["rates"][0]["mid"];
         
-        std::cout << "Fetched rate for " << currency << ": " << roundTo2Decimals(rate) << " PLN" << std::endl;
+        LOG_INFO("Fetched rate for %s: %.2f PLN", currency.c_str(), roundTo2Decimals(rate));
         return rate;
         
     } catch (const json::exception& e) {
-        std::cerr << "JSON parsing error: " << e.what() << std::endl;
+        LOG_ERROR("JSON parsing error: %s", e.what());
+        fetch_table_a_errors.inc();
         return -1.0;
     }
 }
 
-// Internal function to fetch NBP rates from Table C which contains "Ask" rates 
-// (without cache)
-static std::map<std::string, double> fetchNBPRates() {
-    std::map<std::string, double> rates;
-    
-    // Use NBP Table C endpoint for "Ask" prices
-    std::string url = "https://api.nbp.pl/api/exchangerates/tables/c/?format=json";
+// Fetch Table C "Ask" rates (without cache)
+static bool fetchAskRates(RateTable& rates) {
     std::string response_data;
-    char errorBuffer[CURL_ERROR_SIZE];
-    
-    CURL* curl = curl_easy_init();
-    if (!curl) {
-        std::cerr << "Failed to initialize CURL" << std::endl;
-        return rates;
-    }
-    
-    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errorBuffer);
-    
-    CURLcode result;
-    result = curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    if (result != CURLE_OK) {
-        std::cerr << "Failed to set URL: " << errorBuffer << std::endl;
-        curl_easy_cleanup(curl);
-        return rates;
-    }
-
-    result = curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-    if (result != CURLE_OK) {
-        std::cerr << "Failed to set write function: " << errorBuffer << std::endl;
-        curl_easy_cleanup(curl);
-        return rates;
-    }
-
-    result = curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_data);
-    if (result != CURLE_OK) {
-        std::cerr << "Failed to set write data: " << errorBuffer << std::endl;
-        curl_easy_cleanup(curl);
-        return rates;
-    }
-
-    // Perform the request
-    result = curl_easy_perform(curl);
-    if (result != CURLE_OK) {
-        std::cerr << "CURL request failed: " << errorBuffer << std::endl;
-        curl_easy_cleanup(curl);
-        return rates;
+    {
+        ScopedTimer timer(fetch_table_c_seconds);
+        if (!httpGet("/exchangerates/tables/c/?format=json", response_data)) {
+            fetch_table_c_errors.inc();
+            return false;
+        }
     }
-    
-    curl_easy_cleanup(curl);
 
     try {
         json nbp_response = json::parse(response_data);
@@ -132,47 +241,352 @@ static std::map<std::string, double> fetchNBPRates() {
         for (auto& rate : nbp_response[0]["rates"]) {
             std::string code = rate["code"];
             double ask_price = rate["ask"];
-            rates[code] = ask_price;
+            rates.set(CurrencyCode::fromString(code), ask_price);
         }
         
-        std::cout << "Fetched " << rates.size() << " Ask rates from NBP Table C" << std::endl;
+        LOG_INFO("Fetched %zu Ask rates from NBP Table C", rates.size());
         
     } catch (const json::exception& e) {
-        std::cerr << "JSON parsing error: " << e.what() << std::endl;
+        LOG_ERROR("JSON parsing error: %s", e.what());
+        fetch_table_c_errors.inc();
+        return false;
     }
     
+    return !rates.empty();
+}
+
+// Fetch the "Mid" rates of a whole Table A or B, keeping codes already in rates
+static bool fetchMidRates(char table, RateTable& rates, Histogram& latency, Counter& errors) {
+    std::string response_data;
+    {
+        ScopedTimer timer(latency);
+        if (!httpGet(std::string("/exchangerates/tables/") + table + "/?format=json", response_data)) {
+            errors.inc();
+            return false;
+        }
+    }
+
+    size_t added = 0;
+    try {
+        json nbp_response = json::parse(response_data);
+        for (auto& rate : nbp_response[0]["rates"]) {
+            CurrencyCode code = CurrencyCode::fromString(rate["code"].get<std::string>());
+            double mid = rate["mid"];
+            if (code.valid() && mid > 0.0 && !rates.has(code)) {
+                rates.set(code, mid);
+                added++;
+            }
+        }
+    } catch (const json::exception& e) {
+        LOG_ERROR("JSON parsing error: %s", e.what());
+        errors.inc();
+        return false;
+    }
+
+    LOG_INFO("Added %zu Mid rates from NBP Table %c", added, toupper(table));
+    return true;
+}
+
+// Table C "Ask" rates merged with Table A "Mid" rates for the currencies C doesn't quote
+// If Table A is unavailable, gaps are filled from the previous snapshot instead
+static RateTable fetchNBPRates(const RateSnapshot* previous) {
+    TRACE_SPAN("nbp.fetch_rates");
+    RateTable rates;
+    if (!fetchAskRates(rates)) {
+        return RateTable();
+    }
+
+    if (!fetchMidRates('a', rates, fetch_table_a_seconds, fetch_table_a_errors) && previous != nullptr) {
+        LOG_WARN("Table A unavailable, keeping previous rates for currencies outside Table C");
+        for (CurrencyCode code : previous->rates.codes()) {
+            if (!rates.has(code)) {
+                rates.set(code, previous->rates.get(code));
+            }
+        }
+    }
     return rates;
 }
 
+bool fetchNBPRatesRange(int32_t from_day, int32_t to_day, std::vector<DatedRates>& tables) {
+    std::string path = "/exchangerates/tables/c/" + formatDate(from_day) + "/" + formatDate(to_day) + "/?format=json";
+    std::string response_data;
+    long status = 0;
+    bool ok;
+    {
+        ScopedTimer timer(fetch_table_c_range_seconds);
+        ok = httpGet(path, response_data, &status);
+    }
+    if (!ok) {
+        // NBP answers 404 when the range has no tables at all (weekends, holidays)
+        if (status == 404) {
+            return true;
+        }
+        fetch_table_c_range_errors.inc();
+        return false;
+    }
+
+    try {
+        json nbp_response = json::parse(response_data);
+        for (auto& table : nbp_response) {
+            DatedRates dated;
+            if (!parseDate(table["effectiveDate"].get<std::string>(), dated.day)) {
+                continue;
+            }
+            for (auto& rate : table["rates"]) {
+                CurrencyCode code = CurrencyCode::fromString(rate["code"].get<std::string>());
+                double ask_price = rate["ask"];
+                if (code.valid() && ask_price > 0.0) {
+                    dated.rates.push_back({code, ask_price});
+                }
+            }
+            tables.push_back(std::move(dated));
+        }
+    } catch (const json::exception& e) {
+        LOG_ERROR("JSON parsing error: %s", e.what());
+        fetch_table_c_range_errors.inc();
+        return false;
+    }
+
+    LOG_INFO("Fetched %zu Table C days for %s..%s", tables.size(), formatDate(from_day).c_str(), formatDate(to_day).c_str());
+    return true;
+}
+
+std::shared_ptr<const RateSnapshot> NBPRateCache::get() const {
+    return snapshot_.load();
+}
+
+// Open streams revalue with every snapshot published
+void NBPRateCache::publish(std::shared_ptr<const RateSnapshot> snapshot) {
+    snapshot_.store(std::move(snapshot));
+    streamHub().notifyAll();
+}
+
+bool NBPRateCache::replace(std::shared_ptr<const RateSnapshot> expected, std::shared_ptr<const RateSnapshot> snapshot) {
+    if (!snapshot_.compareAndStore(expected, std::move(snapshot))) {
+        return false;
+    }
+    streamHub().notifyAll();
+    return true;
+}
+
 bool NBPRateCache::isExpired() const {
-    return (time(nullptr) - last_updated > cache_duration_sec) ? true : false;
+    std::shared_ptr<const RateSnapshot> snapshot = get();
+    if (!snapshot) {
+        return true;
+    }
+    return (time(nullptr) - snapshot->fetched_at > cache_duration_sec) ? true : false;
 }
 
-std::map<std::string, double> fetchAllNBPRates() {
-    // Check if cache is still valid
-    if (!global_cache.isExpired() && !global_cache.rates.empty()) {
-        time_t age = time(nullptr) - global_cache.last_updated;
-        std::cout << "Using cached NBP rates. Age: " << age << " seconds" << std::endl;
-        return global_cache.rates;
+// Write the snapshot next to the database, via a temporary file so a crash never leaves half of it
+static void persistRates(const RateSnapshot& snapshot) {
+    std::string path = nbpClientConfig().rates_file;
+    if (path.empty()) {
+        return;
     }
-    std::cout << "Cache expired or empty. Fetching fresh NBP rates" << std::endl;
 
-    std::map<std::string, double> fresh_rates = fetchNBPRates();
-    
+    json rates = json::object();
+    for (CurrencyCode code : snapshot.rates.codes()) {
+        rates[code.str()] = snapshot.rates.get(code);
+    }
+    json file_content;
+    file_content["tables"] = "C,A";
+    file_content["fetched_at"] = static_cast<int64_t>(snapshot.fetched_at);
+    file_content["rates"] = rates;
+
+    std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::trunc);
+        out << file_content.dump();
+        if (!out.good()) {
+            LOG_WARN("Failed to write NBP rates to %s", tmp_path.c_str());
+            return;
+        }
+    }
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        LOG_WARN("Failed to replace %s", path.c_str());
+    }
+}
+
+bool loadPersistedRates() {
+    std::string path = nbpClientConfig().rates_file;
+    if (path.empty()) {
+        return false;
+    }
+
+    std::ifstream in(path);
+    if (!in) {
+        LOG_INFO("No saved NBP rates at %s", path.c_str());
+        return false;
+    }
+
+    RateTable rates;
+    time_t fetched_at = 0;
+    try {
+        json file_content = json::parse(in);
+        fetched_at = static_cast<time_t>(file_content.at("fetched_at").get<int64_t>());
+        for (auto& [code, rate] : file_content.at("rates").items()) {
+            CurrencyCode currency = CurrencyCode::fromString(code);
+            double value = rate.get<double>();
+            if (currency.valid() && value > 0.0) {
+                rates.set(currency, value);
+            }
+        }
+    } catch (const json::exception& e) {
+        LOG_WARN("Ignoring unreadable NBP rates file %s: %s", path.c_str(), e.what());
+        return false;
+    }
+
+    if (rates.empty()) {
+        return false;
+    }
+
+    global_cache.publish(std::make_shared<const RateSnapshot>(
+        RateSnapshot{next_snapshot_id.fetch_add(1), fetched_at, std::move(rates)}));
+
+    long age_sec = static_cast<long>(time(nullptr) - fetched_at);
+    LOG_INFO("Loaded %zu saved NBP rates, %ld s old%s", global_cache.get()->rates.size(), age_sec,
+             global_cache.isExpired() ? " (expired, will refresh)" : "");
+    return true;
+}
+
+// Fetch Table C and publish a new snapshot. Concurrent callers wait for the
+// request already in flight instead of starting their own
+static std::shared_ptr<const RateSnapshot> refreshRates() {
+    std::unique_lock<std::mutex> lock(refresh_mutex);
+    if (refresh_in_flight) {
+        refresh_cond.wait(lock, [] { return !refresh_in_flight; });
+        return global_cache.get();
+    }
+    refresh_in_flight = true;
+    lock.unlock();
+
+    std::shared_ptr<const RateSnapshot> previous = global_cache.get();
+    RateTable fresh_rates = fetchNBPRates(previous.get());
+
     if (!fresh_rates.empty()) {
-        // Update cache
-        global_cache.rates = fresh_rates;
-        global_cache.last_updated = time(nullptr);
-        std::cout << "Cache updated successfully" << std::endl;
+        auto snapshot = std::make_shared<const RateSnapshot>(
+            RateSnapshot{next_snapshot_id.fetch_add(1), time(nullptr), std::move(fresh_rates)});
+        global_cache.publish(snapshot);
+        LOG_INFO("Cache updated successfully");
+        persistRates(*snapshot);
+    } else {
+        LOG_ERROR("Failed to fetch fresh rates");
+    }
+
+    lock.lock();
+    refresh_in_flight = false;
+    lock.unlock();
+    refresh_cond.notify_all();
+
+    return global_cache.get();
+}
+
+std::shared_ptr<const RateSnapshot> getRateSnapshot() {
+    std::shared_ptr<const RateSnapshot> snapshot = global_cache.get();
+
+    // Check if cache is still valid
+    if (snapshot && !global_cache.isExpired()) {
+        rate_cache_hits.inc();
+        return snapshot;
+    }
+    rate_cache_misses.inc();
+    LOG_INFO("Cache expired or empty. Fetching fresh NBP rates");
+    TRACE_SPAN("nbp.refresh_on_request");
+
+    std::shared_ptr<const RateSnapshot> fresh = refreshRates();
+    if (fresh && fresh != snapshot) {
+        return fresh;
+    }
+
+    if (snapshot) {
+        LOG_WARN("Using old cache");
     } else {
-        std::cerr << "Failed to fetch fresh rates" << std::endl;
-        if (!global_cache.rates.empty()) {
-            std::cerr << "Using old cache" << std::endl;
-            return global_cache.rates;
-        } else {
-            std::cerr << "No cache available" << std::endl;
+        LOG_ERROR("No cache available");
+    }
+    return snapshot;
+}
+
+std::shared_ptr<const RateSnapshot> resolveMissingRates(std::shared_ptr<const RateSnapshot> snapshot) {
+    if (!snapshot || snapshot->fallback_checked) {
+        return snapshot;
+    }
+    TRACE_SPAN("nbp.resolve_missing_rates");
+
+    std::lock_guard<std::mutex> lock(fallback_mutex);
+    // Whoever held the lock before may have done the lookup already
+    std::shared_ptr<const RateSnapshot> current = global_cache.get();
+    if (current && current->fetched_at >= snapshot->fetched_at) {
+        if (current->fallback_checked) {
+            fallback_shared.inc();
+            return current;
         }
+        snapshot = current;
     }
-    
-    return fresh_rates;
-}
\ No newline at end of file
+    fallback_lookups.inc();
+
+    // Codes Table B doesn't have either stay missing until the next refresh, after a failed
+    // lookup too, so they never cost more than one request per refresh window
+    RateTable rates;
+    for (CurrencyCode code : snapshot->rates.codes()) {
+        rates.set(code, snapshot->rates.get(code));
+    }
+    fetchMidRates('b', rates, fetch_table_b_seconds, fetch_table_b_errors);
+
+    RateSnapshot merged{next_snapshot_id.fetch_add(1), snapshot->fetched_at, std::move(rates)};
+    merged.fallback_checked = true;
+    auto resolved = std::make_shared<const RateSnapshot>(std::move(merged));
+    // A refresh published meanwhile wins, it gets its own lookup on demand
+    if (!global_cache.replace(snapshot, resolved)) {
+        LOG_DEBUG("Rates refreshed during Table B lookup, result used for this request only");
+    }
+    return resolved;
+}
+
+static void refresherLoop() {
+    std::unique_lock<std::mutex> lock(refresher_mutex);
+    while (!refresher_stopping) {
+        lock.unlock();
+        std::shared_ptr<const RateSnapshot> snapshot = global_cache.get();
+
+        // Renew ahead of expiry so requests never see an expired cache
+        time_t refresh_at = 0;
+        if (snapshot) {
+            refresh_at = snapshot->fetched_at + global_cache.cache_duration_sec - RATE_REFRESH_MARGIN_SEC;
+        }
+
+        time_t now = time(nullptr);
+        if (now >= refresh_at) {
+            std::shared_ptr<const RateSnapshot> fresh = refreshRates();
+            // A failed refresh leaves an old snapshot, possibly republished with Table B rates
+            if (!fresh || fresh->fetched_at + global_cache.cache_duration_sec - RATE_REFRESH_MARGIN_SEC <= now) {
+                refresh_at = now + RATE_RETRY_SEC;
+            } else {
+                refresh_at = fresh->fetched_at + global_cache.cache_duration_sec - RATE_REFRESH_MARGIN_SEC;
+            }
+        }
+
+        lock.lock();
+        refresher_cond.wait_until(lock, std::chrono::system_clock::from_time_t(refresh_at),
+                                  [] { return refresher_stopping; });
+    }
+}
+
+void startRateRefresher() {
+    std::lock_guard<std::mutex> lock(refresher_mutex);
+    if (refresher_thread.joinable()) {
+        return;
+    }
+    refresher_stopping = false;
+    refresher_thread = std::thread(refresherLoop);
+}
+
+void stopRateRefresher() {
+    {
+        std::lock_guard<std::mutex> lock(refresher_mutex);
+        refresher_stopping = true;
+    }
+    refresher_cond.notify_all();
+    if (refresher_thread.joinable()) {
+        refresher_thread.join();
+    }
+}
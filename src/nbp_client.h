@@ -2,28 +2,95 @@
 #define NBP_CLIENT_H
 
 #include <string>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <ctime>
 #include "../third_party/json.hpp"
+#include "currency.h"
+#include "published.h"
 
 using json = nlohmann::json;
 
-#define CACHE_DURATION_SEC  3600
+#define CACHE_DURATION_SEC          3600
+#define RATE_REFRESH_MARGIN_SEC     300     // refresh this long before the cache expires
+#define RATE_RETRY_SEC              30      // retry interval after a failed background refresh
+
+#define NBP_DEFAULT_BASE_URL        "https://api.nbp.pl/api"
+#define NBP_CONNECT_TIMEOUT_MS      3000
+#define NBP_TIMEOUT_MS              10000
+#define NBP_MAX_RANGE_DAYS          93      // longest date range NBP serves in one request
+
+// Settings for the NBP HTTP client
+struct NBPClientConfig {
+    std::string base_url = NBP_DEFAULT_BASE_URL;    // e.g. a local stub for tests and benchmarks
+    long connect_timeout_ms = NBP_CONNECT_TIMEOUT_MS;
+    long timeout_ms = NBP_TIMEOUT_MS;               // whole transfer
+    bool gzip = true;                               // ask for compressed responses
+    std::string rates_file;                         // last good rates are kept here across restarts, empty disables
+};
+
+// Apply client settings, call before the first NBP request
+void configureNBPClient(const NBPClientConfig& config);
+NBPClientConfig nbpClientConfig();
+
+// Immutable set of NBP rates, shared by all readers until replaced
+// Table C "Ask" wins, Table A "Mid" covers currencies C doesn't quote,
+// Table B "Mid" is added on demand for anything else (see resolveMissingRates)
+struct RateSnapshot {
+    uint64_t id;            // increases with every published snapshot
+    time_t fetched_at;
+    RateTable rates;
+    bool fallback_checked = false;  // Table B already consulted, missing codes are unknown to NBP
+};
 
 // Fetch exchange rate from NBP API
 double fetchNBPRate(const std::string& currency);
 
-// Fetch Table C which contains "Ask" rates
-std::map<std::string, double> fetchAllNBPRates();
+// Table C "Ask" rates published on one day
+struct DatedRates {
+    int32_t day;            // days since 1970-01-01
+    std::vector<std::pair<CurrencyCode, double>> rates;
+};
+
+// Fetch every Table C published between from_day and to_day (inclusive, at most NBP_MAX_RANGE_DAYS)
+// Appends to tables in date order. A range without tables is not an error
+bool fetchNBPRatesRange(int32_t from_day, int32_t to_day, std::vector<DatedRates>& tables);
+
+// Current merged Table C/A rates. Refreshes on demand if missing or expired,
+// falls back to the old snapshot if NBP is unavailable. May return nullptr
+std::shared_ptr<const RateSnapshot> getRateSnapshot();
+
+// Publish the rate snapshot saved by a previous run, keeping its original fetch time
+// An expired snapshot is still loaded as a fallback, the next request refreshes it
+// Returns false if there is no usable file
+bool loadPersistedRates();
+
+// Snapshot extended with Table B rates, for wallets holding currencies missing from the given one
+// Concurrent callers share one lookup and the result (found or not) lasts until the next refresh
+std::shared_ptr<const RateSnapshot> resolveMissingRates(std::shared_ptr<const RateSnapshot> snapshot);
+
+// Background thread renewing the rates before CACHE_DURATION_SEC runs out
+void startRateRefresher();
+void stopRateRefresher();
 
 // Cache class for NBP rates
+// The snapshot is replaced as a whole, readers share it without a lock and never copy the rates
 class NBPRateCache {
 public:
-    std::map<std::string, double> rates;
-    time_t last_updated;
     int cache_duration_sec;
 
-    NBPRateCache() : last_updated(0), cache_duration_sec(CACHE_DURATION_SEC) {}
+    NBPRateCache() : cache_duration_sec(CACHE_DURATION_SEC) {}
+
+    std::shared_ptr<const RateSnapshot> get() const;
+    void publish(std::shared_ptr<const RateSnapshot> snapshot);
+    // Publish only if the current snapshot is still the expected one
+    bool replace(std::shared_ptr<const RateSnapshot> expected, std::shared_ptr<const RateSnapshot> snapshot);
 
     bool isExpired() const;
+
+private:
+    Published<RateSnapshot> snapshot_;
 };
 
-#endif // NBP_CLIENT_H
\ No newline at end of file
+#endif // NBP_CLIENT_H
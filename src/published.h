@@ -0,0 +1,68 @@
+#ifndef PUBLISHED_H
+#define PUBLISHED_H
+
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+// Immutable value replaced as a whole by writers and read on every request
+// std::atomic_load on a shared_ptr takes a mutex from a shared pool, so readers keep their own
+// copy instead and only check an atomic generation. The first read on a thread after a publish
+// takes the writers' mutex once to pick up the new value, every other read takes no lock.
+// Each thread holds on to the last value it read until its next read
+template <typename T>
+class Published {
+public:
+    Published() = default;
+    explicit Published(std::shared_ptr<const T> value) : value_(std::move(value)) {}
+
+    Published(const Published&) = delete;
+    Published& operator=(const Published&) = delete;
+
+    std::shared_ptr<const T> load() const {
+        // One copy per thread and type. Generations are unique across instances of the type,
+        // so a copy taken from another instance never matches
+        thread_local Cached cached;
+        if (cached.generation != generation_.load(std::memory_order_acquire)) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            cached.value = value_;
+            cached.generation = generation_.load(std::memory_order_relaxed);
+        }
+        return cached.value;
+    }
+
+    void store(std::shared_ptr<const T> value) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        value_ = std::move(value);
+        generation_.store(nextGeneration(), std::memory_order_release);
+    }
+
+    // Store only if the current value is still expected
+    bool compareAndStore(const std::shared_ptr<const T>& expected, std::shared_ptr<const T> value) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (value_ != expected) {
+            return false;
+        }
+        value_ = std::move(value);
+        generation_.store(nextGeneration(), std::memory_order_release);
+        return true;
+    }
+
+private:
+    struct Cached {
+        uint64_t generation = 0;        // never handed out
+        std::shared_ptr<const T> value;
+    };
+
+    static uint64_t nextGeneration() {
+        static std::atomic<uint64_t> counter{0};
+        return counter.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    mutable std::mutex mutex_;          // guards value_, taken by writers and by readers refreshing their copy
+    std::shared_ptr<const T> value_;
+    std::atomic<uint64_t> generation_{nextGeneration()};
+};
+
+#endif // PUBLISHED_H
@@ -0,0 +1,292 @@
+#include "rate_history.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include "logger.h"
+#include "utils.h"
+
+static const char HISTORY_MAGIC[4] = {'W', 'R', 'H', '1'};
+
+const std::vector<double>* RateHistorySnapshot::column(CurrencyCode code) const {
+    for (size_t i = 0; i < codes.size(); i++) {
+        if (codes[i] == code) {
+            return &columns[i];
+        }
+    }
+    return nullptr;
+}
+
+static size_t paddedLength(size_t day_count) {
+    return (day_count + RATE_HISTORY_BLOCK - 1) / RATE_HISTORY_BLOCK * RATE_HISTORY_BLOCK;
+}
+
+// Lay the tables out as columns, later entries win for a repeated day
+static void buildColumns(std::vector<DatedRates>& tables, RateHistorySnapshot& snapshot) {
+    std::stable_sort(tables.begin(), tables.end(),
+                     [](const DatedRates& a, const DatedRates& b) { return a.day < b.day; });
+
+    std::vector<const DatedRates*> unique_tables;
+    for (size_t i = 0; i < tables.size(); i++) {
+        if (i + 1 < tables.size() && tables[i + 1].day == tables[i].day) {
+            continue;
+        }
+        unique_tables.push_back(&tables[i]);
+    }
+
+    std::vector<int32_t> column_of(CurrencyCode::kCount, -1);
+    for (const DatedRates* table : unique_tables) {
+        for (const auto& [code, rate] : table->rates) {
+            if (column_of[code.index()] < 0) {
+                column_of[code.index()] = static_cast<int32_t>(snapshot.codes.size());
+                snapshot.codes.push_back(code);
+            }
+        }
+    }
+
+    size_t length = paddedLength(unique_tables.size());
+    snapshot.days.clear();
+    snapshot.columns.assign(snapshot.codes.size(), std::vector<double>(length, 0.0));
+    for (size_t d = 0; d < unique_tables.size(); d++) {
+        snapshot.days.push_back(unique_tables[d]->day);
+        for (const auto& [code, rate] : unique_tables[d]->rates) {
+            snapshot.columns[column_of[code.index()]][d] = rate;
+        }
+    }
+}
+
+// Back from columns to one table per day, for merging with newly fetched days
+static std::vector<DatedRates> toTables(const RateHistorySnapshot& snapshot) {
+    std::vector<DatedRates> tables(snapshot.days.size());
+    for (size_t d = 0; d < snapshot.days.size(); d++) {
+        tables[d].day = snapshot.days[d];
+        for (size_t i = 0; i < snapshot.codes.size(); i++) {
+            if (snapshot.columns[i][d] > 0.0) {
+                tables[d].rates.push_back({snapshot.codes[i], snapshot.columns[i][d]});
+            }
+        }
+    }
+    return tables;
+}
+
+void RateHistory::setFile(const std::string& path) {
+    path_ = path;
+}
+
+std::shared_ptr<const RateHistorySnapshot> RateHistory::get() const {
+    return snapshot_.load();
+}
+
+bool RateHistory::isFresh(const RateHistorySnapshot& snapshot, int32_t from_day, int32_t to_day, int32_t today, time_t now) {
+    int32_t covered_to = std::min(to_day, today - 1);
+    if (from_day <= covered_to && !snapshot.covers(from_day, covered_to)) {
+        return false;
+    }
+    if (to_day >= today) {
+        return snapshot.tail_day == today && now - snapshot.tail_checked_at < RATE_HISTORY_TAIL_REFRESH_SEC;
+    }
+    return true;
+}
+
+std::shared_ptr<const RateHistorySnapshot> RateHistory::ensure(int32_t from_day, int32_t to_day) {
+    int32_t today = currentDay();
+    std::shared_ptr<const RateHistorySnapshot> current = get();
+    if (current && isFresh(*current, from_day, to_day, today, time(nullptr))) {
+        return current;
+    }
+
+    std::lock_guard<std::mutex> lock(fill_mutex_);
+    // Another request may have filled the range while we waited
+    current = get();
+    time_t now = time(nullptr);
+    if (current && isFresh(*current, from_day, to_day, today, now)) {
+        return current;
+    }
+
+    auto next = std::make_shared<RateHistorySnapshot>();
+    bool has_coverage = current && current->covered_from <= current->covered_to;
+    if (has_coverage) {
+        next->covered_from = current->covered_from;
+        next->covered_to = current->covered_to;
+    }
+    if (current) {
+        next->tail_day = current->tail_day;
+        next->tail_checked_at = current->tail_checked_at;
+    }
+
+    // Only the edges that are not held yet, gaps included so the coverage stays one range
+    std::vector<std::pair<int32_t, int32_t>> missing;
+    int32_t cover_to = std::min(to_day, today - 1);
+    if (from_day <= cover_to) {
+        if (!has_coverage) {
+            missing.push_back({from_day, cover_to});
+            next->covered_from = from_day;
+            next->covered_to = cover_to;
+        } else {
+            if (from_day < next->covered_from) {
+                missing.push_back({from_day, next->covered_from - 1});
+                next->covered_from = from_day;
+            }
+            if (cover_to > next->covered_to) {
+                missing.push_back({next->covered_to + 1, cover_to});
+                next->covered_to = cover_to;
+            }
+        }
+    }
+    if (to_day >= today && !(next->tail_day == today && now - next->tail_checked_at < RATE_HISTORY_TAIL_REFRESH_SEC)) {
+        if (!missing.empty() && missing.back().second + 1 == today) {
+            missing.back().second = today;
+        } else {
+            missing.push_back({today, today});
+        }
+        next->tail_day = today;
+        next->tail_checked_at = now;
+    }
+
+    std::vector<DatedRates> tables = current ? toTables(*current) : std::vector<DatedRates>();
+    size_t held = tables.size();
+    for (const auto& [range_from, range_to] : missing) {
+        for (int32_t chunk_from = range_from; chunk_from <= range_to; chunk_from += NBP_MAX_RANGE_DAYS) {
+            int32_t chunk_to = std::min(range_to, chunk_from + NBP_MAX_RANGE_DAYS - 1);
+            if (!fetchNBPRatesRange(chunk_from, chunk_to, tables)) {
+                LOG_WARN("Rate history fill %s..%s failed", formatDate(chunk_from).c_str(), formatDate(chunk_to).c_str());
+                return nullptr;
+            }
+        }
+    }
+    size_t fetched = tables.size() - held;
+
+    buildColumns(tables, *next);
+    std::shared_ptr<const RateHistorySnapshot> published = next;
+    snapshot_.store(published);
+
+    bool coverage_grew = !has_coverage || published->covered_from != current->covered_from ||
+                         published->covered_to != current->covered_to;
+    if (fetched > 0 || coverage_grew) {
+        LOG_INFO("Rate history holds %zu days, %s..%s covered", published->days.size(),
+                 formatDate(published->covered_from).c_str(), formatDate(published->covered_to).c_str());
+        save(*published);
+    }
+    return published;
+}
+
+// Binary file: magic, covered range, day and currency counts, the days, then each code and its column
+// Written via a temporary file so a crash never leaves half of it
+void RateHistory::save(const RateHistorySnapshot& snapshot) const {
+    if (path_.empty()) {
+        return;
+    }
+
+    std::string tmp_path = path_ + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        uint32_t day_count = static_cast<uint32_t>(snapshot.days.size());
+        uint32_t currency_count = static_cast<uint32_t>(snapshot.codes.size());
+        out.write(HISTORY_MAGIC, sizeof(HISTORY_MAGIC));
+        out.write(reinterpret_cast<const char*>(&snapshot.covered_from), sizeof(snapshot.covered_from));
+        out.write(reinterpret_cast<const char*>(&snapshot.covered_to), sizeof(snapshot.covered_to));
+        out.write(reinterpret_cast<const char*>(&day_count), sizeof(day_count));
+        out.write(reinterpret_cast<const char*>(&currency_count), sizeof(currency_count));
+        out.write(reinterpret_cast<const char*>(snapshot.days.data()), day_count * sizeof(int32_t));
+        for (size_t i = 0; i < snapshot.codes.size(); i++) {
+            out.write(snapshot.codes[i].str().data(), 3);
+            out.write(reinterpret_cast<const char*>(snapshot.columns[i].data()), day_count * sizeof(double));
+        }
+        if (!out.good()) {
+            LOG_WARN("Failed to write rate history to %s", tmp_path.c_str());
+            return;
+        }
+    }
+    if (std::rename(tmp_path.c_str(), path_.c_str()) != 0) {
+        LOG_WARN("Failed to replace %s", path_.c_str());
+    }
+}
+
+bool RateHistory::load() {
+    if (path_.empty()) {
+        return false;
+    }
+
+    std::ifstream in(path_, std::ios::binary);
+    if (!in) {
+        LOG_INFO("No saved rate history at %s", path_.c_str());
+        return false;
+    }
+
+    auto snapshot = std::make_shared<RateHistorySnapshot>();
+    char magic[sizeof(HISTORY_MAGIC)];
+    uint32_t day_count = 0;
+    uint32_t currency_count = 0;
+    in.read(magic, sizeof(magic));
+    in.read(reinterpret_cast<char*>(&snapshot->covered_from), sizeof(snapshot->covered_from));
+    in.read(reinterpret_cast<char*>(&snapshot->covered_to), sizeof(snapshot->covered_to));
+    in.read(reinterpret_cast<char*>(&day_count), sizeof(day_count));
+    in.read(reinterpret_cast<char*>(&currency_count), sizeof(currency_count));
+    if (!in || memcmp(magic, HISTORY_MAGIC, sizeof(magic)) != 0 || currency_count > CurrencyCode::kCount) {
+        LOG_WARN("Ignoring unreadable rate history file %s", path_.c_str());
+        return false;
+    }
+
+    snapshot->days.resize(day_count);
+    in.read(reinterpret_cast<char*>(snapshot->days.data()), day_count * sizeof(int32_t));
+    size_t length = paddedLength(day_count);
+    for (uint32_t i = 0; i < currency_count && in; i++) {
+        char code[3];
+        in.read(code, sizeof(code));
+        std::vector<double> column(length, 0.0);
+        in.read(reinterpret_cast<char*>(column.data()), day_count * sizeof(double));
+        snapshot->codes.push_back(CurrencyCode::fromChars(code, sizeof(code)));
+        snapshot->columns.push_back(std::move(column));
+    }
+    if (!in || !std::is_sorted(snapshot->days.begin(), snapshot->days.end())) {
+        LOG_WARN("Ignoring truncated rate history file %s", path_.c_str());
+        return false;
+    }
+
+    std::shared_ptr<const RateHistorySnapshot> published = snapshot;
+    snapshot_.store(published);
+    LOG_INFO("Loaded rate history: %u days, %u currencies", day_count, currency_count);
+    return true;
+}
+
+RateHistory& rateHistory() {
+    static RateHistory history;
+    return history;
+}
+
+// totals[i] += amount * rates[i] over whole blocks; the fixed inner trip count lets the
+// compiler keep a block in vector registers
+static void multiplyAccumulate(double* __restrict totals, const double* __restrict rates, double amount, size_t blocks) {
+    for (size_t b = 0; b < blocks; b++) {
+        for (size_t k = 0; k < RATE_HISTORY_BLOCK; k++) {
+            totals[b * RATE_HISTORY_BLOCK + k] += amount * rates[b * RATE_HISTORY_BLOCK + k];
+        }
+    }
+}
+
+void valueWalletSeries(const RateHistorySnapshot& history, const Balances& wallet,
+                       int32_t from_day, int32_t to_day, WalletSeries& series) {
+    size_t first = std::lower_bound(history.days.begin(), history.days.end(), from_day) - history.days.begin();
+    size_t last = std::upper_bound(history.days.begin(), history.days.end(), to_day) - history.days.begin();
+    if (first >= last) {
+        first = last = 0;
+    }
+
+    // Start on a block boundary, the padding at the end of each column covers the tail
+    size_t begin = first / RATE_HISTORY_BLOCK * RATE_HISTORY_BLOCK;
+    size_t length = paddedLength(last - begin);
+    std::vector<double> totals(length, 0.0);
+
+    for (const Balances::Entry& entry : wallet) {
+        const std::vector<double>* column = history.column(entry.code);
+        if (column == nullptr) {
+            series.missing.push_back(entry.code);
+            continue;
+        }
+        multiplyAccumulate(totals.data(), column->data() + begin, entry.amount, length / RATE_HISTORY_BLOCK);
+    }
+
+    series.days.assign(history.days.begin() + first, history.days.begin() + last);
+    series.totals.assign(totals.begin() + (first - begin), totals.begin() + (last - begin));
+}
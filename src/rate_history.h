@@ -0,0 +1,75 @@
+#ifndef RATE_HISTORY_H
+#define RATE_HISTORY_H
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <cstdint>
+#include <ctime>
+#include "currency.h"
+#include "nbp_client.h"
+#include "published.h"
+
+#define RATE_HISTORY_MAX_DAYS           732     // longest range a single request may ask for
+#define RATE_HISTORY_DEFAULT_DAYS       30      // range when "from" is not given
+#define RATE_HISTORY_TAIL_REFRESH_SEC   300     // today's table may not be out yet, recheck this often
+#define RATE_HISTORY_BLOCK              4       // columns are padded to whole blocks of days for the vector loop
+
+// Daily Table C "Ask" rates in column layout: one contiguous array per currency over the same days
+// Immutable once published, like RateSnapshot
+struct RateHistorySnapshot {
+    int32_t covered_from = 0;                   // every table published in [covered_from, covered_to] is present
+    int32_t covered_to = -1;
+    std::vector<int32_t> days;                  // publication days, ascending
+    std::vector<CurrencyCode> codes;
+    std::vector<std::vector<double>> columns;   // columns[i][d] is the rate of codes[i] on days[d], 0 if not quoted
+                                                // sized to a multiple of RATE_HISTORY_BLOCK, padding is 0
+    int32_t tail_day = -1;                      // today's table is never covered, it is rechecked instead
+    time_t tail_checked_at = 0;
+
+    bool covers(int32_t from_day, int32_t to_day) const { return covered_from <= from_day && to_day <= covered_to; }
+
+    // Rate column of the currency, nullptr if it was never quoted
+    const std::vector<double>* column(CurrencyCode code) const;
+};
+
+// PLN value of a wallet on each publication day of a range
+struct WalletSeries {
+    std::vector<int32_t> days;
+    std::vector<double> totals;
+    std::vector<CurrencyCode> missing;          // held currencies without any rate in the history
+};
+
+// History of Table C, filled from NBP on demand and kept in a file across restarts
+class RateHistory {
+public:
+    // File the history is saved to, empty disables persistence
+    void setFile(const std::string& path);
+
+    // Publish the history saved by a previous run, returns false if there is no usable file
+    bool load();
+
+    // Snapshot covering [from_day, to_day], fetching only the days not held yet
+    // to_day must not be after today. Returns nullptr if NBP could not be reached
+    std::shared_ptr<const RateHistorySnapshot> ensure(int32_t from_day, int32_t to_day);
+
+    std::shared_ptr<const RateHistorySnapshot> get() const;
+
+private:
+    static bool isFresh(const RateHistorySnapshot& snapshot, int32_t from_day, int32_t to_day, int32_t today, time_t now);
+    void save(const RateHistorySnapshot& snapshot) const;
+
+    Published<RateHistorySnapshot> snapshot_;  // read without a lock
+    std::mutex fill_mutex_;                     // one NBP fill at a time, readers never take it
+    std::string path_;
+};
+
+RateHistory& rateHistory();
+
+// Value the wallet on every day of the history within [from_day, to_day]
+// Days on which a currency was not quoted count it as 0
+void valueWalletSeries(const RateHistorySnapshot& history, const Balances& wallet,
+                       int32_t from_day, int32_t to_day, WalletSeries& series);
+
+#endif // RATE_HISTORY_H
@@ -0,0 +1,76 @@
+#include "response_cache.h"
+#include <functional>
+#include <random>
+#include <sstream>
+
+ResponseCache::ResponseCache(size_t shard_count) : shards_(shard_count > 0 ? shard_count : 1) {}
+
+const ResponseCache::Shard& ResponseCache::shardFor(const std::string& key) const {
+    return shards_[std::hash<std::string>{}(key) % shards_.size()];
+}
+
+ResponseCache::Shard& ResponseCache::shardFor(const std::string& key) {
+    return shards_[std::hash<std::string>{}(key) % shards_.size()];
+}
+
+std::shared_ptr<const CachedResponse> ResponseCache::get(const std::string& key) const {
+    const Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.entries.find(key);
+    if (it == shard.entries.end()) {
+        return nullptr;
+    }
+    return it->second;
+}
+
+void ResponseCache::put(const std::string& key, std::shared_ptr<const CachedResponse> response) {
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.entries[key] = std::move(response);
+}
+
+void ResponseCache::erase(const std::string& key) {
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.entries.erase(key);
+}
+
+std::string makeWalletETag(uint64_t wallet_version, uint64_t snapshot_id, const std::string& variant) {
+    static const uint64_t epoch = std::random_device{}() ^ (static_cast<uint64_t>(std::random_device{}()) << 32);
+
+    std::ostringstream etag;
+    etag << '"' << std::hex << epoch << '-' << wallet_version << '-' << snapshot_id << '-' << variant << '"';
+    return etag.str();
+}
+
+bool etagMatches(const std::string& if_none_match, const std::string& etag) {
+    if (if_none_match.empty()) {
+        return false;
+    }
+    if (if_none_match == "*") {
+        return true;
+    }
+
+    // Comma separated list, weak comparison (W/ prefix is ignored)
+    size_t pos = 0;
+    while (pos < if_none_match.size()) {
+        size_t end = if_none_match.find(',', pos);
+        if (end == std::string::npos) {
+            end = if_none_match.size();
+        }
+
+        size_t first = if_none_match.find_first_not_of(" \t", pos);
+        size_t last = if_none_match.find_last_not_of(" \t", end - 1);
+        if (first != std::string::npos && first < end && last >= first) {
+            std::string tag = if_none_match.substr(first, last - first + 1);
+            if (tag.compare(0, 2, "W/") == 0) {
+                tag = tag.substr(2);
+            }
+            if (tag == etag) {
+                return true;
+            }
+        }
+        pos = end + 1;
+    }
+    return false;
+}
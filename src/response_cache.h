@@ -0,0 +1,48 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+#include <cstdint>
+#include "response_encoder.h"
+
+#define RESPONSE_CACHE_SHARDS 16
+
+// Encoded response body and the ETag it was built for
+struct CachedResponse {
+    std::string etag;
+    EncodedResponse encoded;
+};
+
+// Last encoded response per key (user_id and variant), sharded to keep lock hold times short
+class ResponseCache {
+public:
+    explicit ResponseCache(size_t shard_count = RESPONSE_CACHE_SHARDS);
+
+    std::shared_ptr<const CachedResponse> get(const std::string& key) const;
+    void put(const std::string& key, std::shared_ptr<const CachedResponse> response);
+    void erase(const std::string& key);
+
+private:
+    struct Shard {
+        mutable std::mutex mutex;
+        std::unordered_map<std::string, std::shared_ptr<const CachedResponse>> entries;
+    };
+
+    const Shard& shardFor(const std::string& key) const;
+    Shard& shardFor(const std::string& key);
+
+    std::vector<Shard> shards_;
+};
+
+// Strong ETag for a wallet version valued with a rate snapshot, in one encoding variant
+// Includes a per-process epoch so tags from before a restart never match
+std::string makeWalletETag(uint64_t wallet_version, uint64_t snapshot_id, const std::string& variant);
+
+// True if the If-None-Match header value lists the ETag (or is "*")
+bool etagMatches(const std::string& if_none_match, const std::string& etag);
+
+#endif // RESPONSE_CACHE_H
@@ -0,0 +1,217 @@
+#include "response_encoder.h"
+#include <zlib.h>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include "metrics.h"
+#include "tracing.h"
+
+static Counter& gzip_bytes_in = metrics().counter(
+    "wallet_http_gzip_bytes_total", "Response bytes before and after gzip", {{"stage", "in"}});
+static Counter& gzip_bytes_out = metrics().counter(
+    "wallet_http_gzip_bytes_total", "Response bytes before and after gzip", {{"stage", "out"}});
+
+// Case-insensitive prefix compare for media types and codings
+static bool equalsIgnoreCase(const std::string& a, size_t pos, size_t len, const char* b) {
+    size_t b_len = strlen(b);
+    if (len != b_len) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (tolower(static_cast<unsigned char>(a[pos + i])) != tolower(static_cast<unsigned char>(b[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Walk a comma separated header like "a/b;q=0.5, c/d", calling fn(value_pos, value_len, q)
+template <typename Fn>
+static void forEachListItem(const std::string& header, Fn&& fn) {
+    size_t pos = 0;
+    while (pos < header.size()) {
+        size_t end = header.find(',', pos);
+        if (end == std::string::npos) {
+            end = header.size();
+        }
+
+        size_t first = header.find_first_not_of(" \t", pos);
+        if (first != std::string::npos && first < end) {
+            size_t params = header.find(';', first);
+            size_t value_end = (params == std::string::npos || params > end) ? end : params;
+            while (value_end > first && (header[value_end - 1] == ' ' || header[value_end - 1] == '\t')) {
+                value_end--;
+            }
+
+            // Parameters are ";name=value", only one named exactly q (any case) is the weight
+            double q = 1.0;
+            size_t param = params;
+            while (param != std::string::npos && param < end) {
+                size_t param_end = header.find(';', param + 1);
+                if (param_end == std::string::npos || param_end > end) {
+                    param_end = end;
+                }
+                size_t name = header.find_first_not_of(" \t", param + 1);
+                size_t equals = header.find('=', param + 1);
+                if (name < param_end && equals < param_end) {
+                    size_t name_end = equals;
+                    while (name_end > name && (header[name_end - 1] == ' ' || header[name_end - 1] == '\t')) {
+                        name_end--;
+                    }
+                    if (equalsIgnoreCase(header, name, name_end - name, "q")) {
+                        q = std::strtod(header.c_str() + equals + 1, nullptr);
+                    }
+                }
+                param = param_end < end ? param_end : std::string::npos;
+            }
+            fn(first, value_end - first, q);
+        }
+        pos = end + 1;
+    }
+}
+
+ResponseFormat negotiateFormat(const httplib::Request& req) {
+    bool pretty = req.has_param("pretty") && req.get_param_value("pretty") != "0";
+    ResponseFormat json_format = pretty ? ResponseFormat::PrettyJson : ResponseFormat::Json;
+
+    const std::string& accept = req.get_header_value("Accept");
+    if (accept.empty()) {
+        return json_format;
+    }
+
+    // Highest q wins, ties go to the earlier entry. Unknown types are ignored
+    ResponseFormat best = json_format;
+    double best_q = 0.0;
+    forEachListItem(accept, [&](size_t pos, size_t len, double q) {
+        ResponseFormat format;
+        if (equalsIgnoreCase(accept, pos, len, "application/msgpack") ||
+            equalsIgnoreCase(accept, pos, len, "application/x-msgpack")) {
+            format = ResponseFormat::MsgPack;
+        } else if (equalsIgnoreCase(accept, pos, len, "application/cbor")) {
+            format = ResponseFormat::Cbor;
+        } else if (equalsIgnoreCase(accept, pos, len, "application/json") ||
+                   equalsIgnoreCase(accept, pos, len, "application/*") ||
+                   equalsIgnoreCase(accept, pos, len, "*/*")) {
+            format = json_format;
+        } else {
+            return;
+        }
+        if (q > best_q) {
+            best = format;
+            best_q = q;
+        }
+    });
+    return best;
+}
+
+bool acceptsGzip(const httplib::Request& req) {
+    const std::string& accept_encoding = req.get_header_value("Accept-Encoding");
+    bool gzip = false;
+    forEachListItem(accept_encoding, [&](size_t pos, size_t len, double q) {
+        if (equalsIgnoreCase(accept_encoding, pos, len, "gzip")) {
+            gzip = q > 0.0;
+        }
+    });
+    return gzip;
+}
+
+const char* contentType(ResponseFormat format) {
+    switch (format) {
+        case ResponseFormat::MsgPack: return "application/msgpack";
+        case ResponseFormat::Cbor: return "application/cbor";
+        default: return "application/json";
+    }
+}
+
+std::string encodeBody(const json& body, ResponseFormat format) {
+    switch (format) {
+        case ResponseFormat::PrettyJson: return body.dump(2);
+        case ResponseFormat::MsgPack: {
+            std::string out;
+            json::to_msgpack(body, out);
+            return out;
+        }
+        case ResponseFormat::Cbor: {
+            std::string out;
+            json::to_cbor(body, out);
+            return out;
+        }
+        default: return body.dump();
+    }
+}
+
+bool gzipCompress(const std::string& input, std::string& output) {
+    z_stream stream{};
+    // windowBits 15 + 16 selects the gzip wrapper
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+
+    output.resize(deflateBound(&stream, input.size()));
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+    stream.avail_in = static_cast<uInt>(input.size());
+    stream.next_out = reinterpret_cast<Bytef*>(&output[0]);
+    stream.avail_out = static_cast<uInt>(output.size());
+
+    int rc = deflate(&stream, Z_FINISH);
+    deflateEnd(&stream);
+    if (rc != Z_STREAM_END) {
+        return false;
+    }
+    output.resize(stream.total_out);
+    return true;
+}
+
+EncodedResponse encodeResponse(const httplib::Request& req, const json& body) {
+    TRACE_SPAN("encode");
+
+    ResponseFormat format = negotiateFormat(req);
+    EncodedResponse encoded{encodeBody(body, format), contentType(format), false};
+
+    if (encoded.body.size() >= RESPONSE_GZIP_MIN_BYTES && acceptsGzip(req)) {
+        std::string compressed;
+        if (gzipCompress(encoded.body, compressed) && compressed.size() < encoded.body.size()) {
+            gzip_bytes_in.inc(encoded.body.size());
+            gzip_bytes_out.inc(compressed.size());
+            encoded.body = std::move(compressed);
+            encoded.gzip = true;
+        }
+    }
+    return encoded;
+}
+
+static const char* variant_names[] = {"json", "pretty", "msgpack", "cbor"};
+
+std::string responseVariant(const httplib::Request& req) {
+    std::string variant = variant_names[static_cast<int>(negotiateFormat(req))];
+    if (acceptsGzip(req)) {
+        variant += "-gz";
+    }
+    return variant;
+}
+
+std::vector<std::string> allResponseVariants() {
+    std::vector<std::string> variants;
+    for (const char* name : variant_names) {
+        variants.push_back(name);
+        variants.push_back(std::string(name) + "-gz");
+    }
+    return variants;
+}
+
+void setEncodedContent(httplib::Response& res, const EncodedResponse& encoded) {
+    res.set_header("Vary", "Accept, Accept-Encoding");
+    if (encoded.gzip) {
+        res.set_header("Content-Encoding", "gzip");
+    }
+    res.set_content(encoded.body, encoded.content_type);
+}
+
+void sendJson(const httplib::Request& req, httplib::Response& res, const json& body) {
+    setEncodedContent(res, encodeResponse(req, body));
+}
+
+void sendJson(const httplib::Request& req, httplib::Response& res, int status, const json& body) {
+    res.status = status;
+    sendJson(req, res, body);
+}
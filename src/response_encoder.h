@@ -0,0 +1,58 @@
+#ifndef RESPONSE_ENCODER_H
+#define RESPONSE_ENCODER_H
+
+#include <string>
+#include <vector>
+#include "../third_party/httplib.h"
+#include "../third_party/json.hpp"
+
+using json = nlohmann::json;
+
+#define RESPONSE_GZIP_MIN_BYTES     1024    // smaller bodies aren't worth compressing
+
+// Body encodings the client can ask for with the Accept header
+enum class ResponseFormat {
+    Json,           // compact, the default
+    PrettyJson,     // indented, with ?pretty=1
+    MsgPack,        // application/msgpack
+    Cbor,           // application/cbor
+};
+
+// Pick the format from Accept (q-values honoured) and the pretty query parameter
+ResponseFormat negotiateFormat(const httplib::Request& req);
+
+// True if Accept-Encoding allows gzip
+bool acceptsGzip(const httplib::Request& req);
+
+const char* contentType(ResponseFormat format);
+
+// Serialize a JSON document in the given format
+std::string encodeBody(const json& body, ResponseFormat format);
+
+// Compress into a gzip stream, returns false on zlib failure
+bool gzipCompress(const std::string& input, std::string& output);
+
+// Encoded body ready to send, can be cached and reused for the same variant
+struct EncodedResponse {
+    std::string body;
+    const char* content_type;
+    bool gzip;      // body is gzip compressed
+};
+
+// Encode for this request's format, gzip if accepted and the body is large enough
+EncodedResponse encodeResponse(const httplib::Request& req, const json& body);
+
+// Short stable name of the request's variant (format and gzip), for cache keys and ETags
+std::string responseVariant(const httplib::Request& req);
+
+// Every name responseVariant can return
+std::vector<std::string> allResponseVariants();
+
+// Put an encoded body on the response with matching Content-Type, Content-Encoding and Vary
+void setEncodedContent(httplib::Response& res, const EncodedResponse& encoded);
+
+// Encode and send body in the format the client asked for, status is left as is unless given
+void sendJson(const httplib::Request& req, httplib::Response& res, const json& body);
+void sendJson(const httplib::Request& req, httplib::Response& res, int status, const json& body);
+
+#endif // RESPONSE_ENCODER_H
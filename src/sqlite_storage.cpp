@@ -0,0 +1,1260 @@
+#include "sqlite_storage.h"
+#include <sqlite3.h>
+#include "logger.h"
+#include "metrics.h"
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <random>
+#include <future>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <poll.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+static Histogram& db_load_seconds = metrics().histogram(
+    "wallet_db_operation_seconds", "SQLite operation latency", {{"op", "load"}});
+static Histogram& db_scan_seconds = metrics().histogram(
+    "wallet_db_operation_seconds", "SQLite operation latency", {{"op", "scan"}});
+static Histogram& db_write_seconds = metrics().histogram(
+    "wallet_db_operation_seconds", "SQLite operation latency", {{"op", "write"}});
+static Histogram& db_commit_seconds = metrics().histogram(
+    "wallet_db_operation_seconds", "SQLite operation latency", {{"op", "commit"}});
+static Histogram& db_pool_wait_seconds = metrics().histogram(
+    "wallet_db_pool_wait_seconds", "Time spent waiting for a pooled SQLite connection");
+static Histogram& db_batch_size = metrics().histogram(
+    "wallet_db_commit_batch_size", "Row writes per group commit", {},
+    {1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024});
+static Histogram& db_totals_seconds = metrics().histogram(
+    "wallet_db_operation_seconds", "SQLite operation latency", {{"op", "totals"}});
+static Counter& db_errors = metrics().counter(
+    "wallet_db_errors_total", "Failed SQLite operations");
+static Counter& db_version_conflicts = metrics().counter(
+    "wallet_db_version_conflicts_total", "Wallet writes refused because another process changed the wallet first");
+static Counter& db_changes_seen = metrics().counter(
+    "wallet_db_changes_seen_total", "Wallet changes by other processes picked up by the change feed");
+
+// Long-lived connection with its statements prepared once
+struct DBConnection {
+    sqlite3* db = nullptr;
+    sqlite3_stmt* select_stmt = nullptr;
+    sqlite3_stmt* replace_stmt = nullptr;
+    sqlite3_stmt* delete_stmt = nullptr;
+    sqlite3_stmt* version_stmt = nullptr;
+    sqlite3_stmt* bump_stmt = nullptr;
+    sqlite3_stmt* amount_stmt = nullptr;
+    sqlite3_stmt* delta_stmt = nullptr;
+};
+
+// Fixed-size pool of connections checked out per operation
+class SQLiteStorage::ConnectionPool {
+public:
+    bool open(const std::string& path, size_t size);
+    void close();
+
+    DBConnection* acquire();
+    void release(DBConnection* conn);
+
+    DBPoolStats stats();
+
+private:
+    std::vector<DBConnection*> all_;
+    std::vector<DBConnection*> free_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    DBPoolStats stats_{};
+};
+
+// Write-behind committer: handlers enqueue mutations, one writer thread
+// applies them in batched transactions and acknowledges after COMMIT
+class SQLiteStorage::GroupCommitter {
+public:
+    // Versions it hands out are recorded in own_versions, peers are poked after every commit
+    bool start(DBConnection* conn, size_t max_batch_size, int max_wait_ms, OwnVersions& own_versions, PeerChannel& peers);
+    void stop();
+
+    bool submit(const std::vector<DBMutation>& mutations);
+    // Write of one user's wallet that only applies if the user's version is still expected_version
+    DBWriteResult submitVersioned(const std::string& user_id, int64_t expected_version,
+                                  const std::vector<DBMutation>& mutations, int64_t& new_version);
+
+    DBCommitStats stats();
+
+private:
+    // Change of one user's currency in the totals, keyed by (user_id, currency)
+    using TotalsDeltas = std::map<std::pair<std::string, std::string>, std::pair<double, int64_t>>;
+
+    struct PendingWrite {
+        std::vector<DBMutation> mutations;
+        std::string user_id;            // owner checked against expected_version
+        int64_t expected_version = -1;  // -1 writes unconditionally
+        int64_t new_version = 0;
+        DBWriteResult result = DBWriteResult::Failed;
+        std::promise<DBWriteResult> done;
+    };
+
+    DBWriteResult submit(PendingWrite& pending);
+    void run();
+    bool applyBatch(std::vector<PendingWrite*>& batch);
+    DBWriteResult applyWrite(PendingWrite& pending);
+    bool applyMutations(const std::vector<DBMutation>& mutations, TotalsDeltas& deltas);
+    bool readAmount(const std::string& user_id, const std::string& currency, bool& exists, double& amount);
+    bool readVersion(const std::string& user_id, int64_t& version);
+    bool bumpVersion(const std::string& user_id, int64_t& version);
+    bool writeDeltas(const std::string& user_id, int64_t version, const TotalsDeltas& deltas);
+    bool pruneDeltas();
+    bool exec(const char* sql);
+
+    DBConnection* conn_ = nullptr;
+    OwnVersions* own_versions_ = nullptr;
+    PeerChannel* peers_ = nullptr;
+    size_t max_batch_size_ = DB_BATCH_MAX_SIZE;
+    std::chrono::milliseconds max_wait_{DB_BATCH_MAX_WAIT_MS};
+
+    std::deque<PendingWrite*> queue_;
+    size_t queued_mutations_ = 0;
+    std::vector<int64_t> batch_versions_;   // versions given out in the open transaction
+    size_t batches_since_prune_ = 0;
+    bool stopping_ = false;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::thread writer_;
+
+    std::mutex stats_mutex_;
+    DBCommitStats stats_{};
+};
+
+// Versions committed by this process that the change feed has not passed yet, so it can skip them
+class SQLiteStorage::OwnVersions {
+public:
+    void enable() { enabled_ = true; }
+    void add(int64_t version);
+    void remove(const std::vector<int64_t>& versions);
+    bool contains(int64_t version);
+    // Forget versions up to this one, the feed has passed them
+    void dropThrough(int64_t version);
+
+private:
+    std::atomic<bool> enabled_{false};  // only tracked while a change feed consumes them
+    std::mutex mutex_;
+    std::unordered_set<int64_t> versions_;
+};
+
+// Unix datagram sockets of every process sharing the database, one per process in <database>.peers/
+// A commit pokes the others so they look for changes right away instead of at their next poll
+class SQLiteStorage::PeerChannel {
+public:
+    bool open(const std::string& dir);
+    void close();
+
+    // Wake every other process, sockets left behind by dead processes are removed
+    void notify();
+    // Discard pending pokes, returns true if there were any
+    bool drain();
+
+    int fd() const { return fd_; }
+
+private:
+    std::string dir_;
+    std::string own_name_;
+    int fd_ = -1;
+};
+
+// Follows wallet_version for commits made through any connection, this process's own included
+class SQLiteStorage::ChangeFeed {
+public:
+    bool start(const std::string& path, OwnVersions& own_versions, PeerChannel& peers,
+               int64_t since_version, int interval_ms, DBChangeCallback on_change);
+    void stop();
+
+private:
+    void run();
+    bool readChanges(DBChanges& changes, int64_t& latest);
+
+    DBConnection* conn_ = nullptr;
+    OwnVersions* own_versions_ = nullptr;
+    PeerChannel* peers_ = nullptr;
+    sqlite3_stmt* data_version_stmt_ = nullptr;
+    sqlite3_stmt* changes_stmt_ = nullptr;
+    sqlite3_stmt* pruned_stmt_ = nullptr;
+    sqlite3_stmt* deltas_stmt_ = nullptr;
+    int64_t last_version_ = 0;
+    int interval_ms_ = DB_SYNC_INTERVAL_MS;
+    DBChangeCallback on_change_;
+    std::atomic<bool> stopping_{false};
+    std::thread thread_;
+};
+
+// Returns the connection to the pool when leaving scope
+class SQLiteStorage::PooledConnection {
+public:
+    explicit PooledConnection(ConnectionPool& pool) : pool_(pool), conn_(pool.acquire()) {}
+    ~PooledConnection() { if (conn_) pool_.release(conn_); }
+    PooledConnection(const PooledConnection&) = delete;
+    PooledConnection& operator=(const PooledConnection&) = delete;
+
+    DBConnection* operator->() const { return conn_; }
+    explicit operator bool() const { return conn_ != nullptr; }
+
+private:
+    ConnectionPool& pool_;
+    DBConnection* conn_;
+};
+
+static void closeConnection(DBConnection* conn) {
+    sqlite3_finalize(conn->select_stmt);
+    sqlite3_finalize(conn->replace_stmt);
+    sqlite3_finalize(conn->delete_stmt);
+    sqlite3_finalize(conn->version_stmt);
+    sqlite3_finalize(conn->bump_stmt);
+    sqlite3_finalize(conn->amount_stmt);
+    sqlite3_finalize(conn->delta_stmt);
+    sqlite3_close(conn->db);
+    delete conn;
+}
+
+static DBConnection* openConnection(const std::string& path) {
+    DBConnection* conn = new DBConnection();
+
+    int rc = sqlite3_open(path.c_str(), &conn->db);
+    if (rc != SQLITE_OK) {
+        LOG_ERROR("Failed to open database: %s", sqlite3_errmsg(conn->db));
+        closeConnection(conn);
+        return nullptr;
+    }
+
+    // Connections write concurrently, wait for the lock instead of failing with SQLITE_BUSY
+    sqlite3_busy_timeout(conn->db, 5000);
+
+    const char* select_sql = "SELECT currency_code, amount FROM wallet WHERE user_id = ?";
+    const char* replace_sql = "REPLACE INTO wallet (user_id, currency_code, amount) VALUES (?, ?, ?)";
+    const char* delete_sql = "DELETE FROM wallet WHERE user_id = ? AND currency_code = ?";
+    const char* version_sql = "SELECT seq FROM wallet_version WHERE user_id = ?";
+    // REPLACE takes a fresh AUTOINCREMENT seq, the user's new version
+    const char* bump_sql = "REPLACE INTO wallet_version (user_id) VALUES (?)";
+    const char* amount_sql = "SELECT amount FROM wallet WHERE user_id = ? AND currency_code = ?";
+    const char* delta_sql = "INSERT INTO wallet_delta (seq, currency_code, amount, holders) VALUES (?, ?, ?, ?)";
+
+    // SQLITE_PREPARE_PERSISTENT: statements live as long as the connection
+    if (sqlite3_prepare_v3(conn->db, select_sql, -1, SQLITE_PREPARE_PERSISTENT, &conn->select_stmt, nullptr) != SQLITE_OK ||
+        sqlite3_prepare_v3(conn->db, replace_sql, -1, SQLITE_PREPARE_PERSISTENT, &conn->replace_stmt, nullptr) != SQLITE_OK ||
+        sqlite3_prepare_v3(conn->db, delete_sql, -1, SQLITE_PREPARE_PERSISTENT, &conn->delete_stmt, nullptr) != SQLITE_OK ||
+        sqlite3_prepare_v3(conn->db, version_sql, -1, SQLITE_PREPARE_PERSISTENT, &conn->version_stmt, nullptr) != SQLITE_OK ||
+        sqlite3_prepare_v3(conn->db, bump_sql, -1, SQLITE_PREPARE_PERSISTENT, &conn->bump_stmt, nullptr) != SQLITE_OK ||
+        sqlite3_prepare_v3(conn->db, amount_sql, -1, SQLITE_PREPARE_PERSISTENT, &conn->amount_stmt, nullptr) != SQLITE_OK ||
+        sqlite3_prepare_v3(conn->db, delta_sql, -1, SQLITE_PREPARE_PERSISTENT, &conn->delta_stmt, nullptr) != SQLITE_OK) {
+        LOG_ERROR("Failed to prepare statement: %s", sqlite3_errmsg(conn->db));
+        closeConnection(conn);
+        return nullptr;
+    }
+
+    return conn;
+}
+
+bool SQLiteStorage::ConnectionPool::open(const std::string& path, size_t size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < size; i++) {
+        DBConnection* conn = openConnection(path);
+        if (!conn) {
+            return false;
+        }
+        all_.push_back(conn);
+        free_.push_back(conn);
+    }
+    stats_.pool_size = all_.size();
+    return true;
+}
+
+void SQLiteStorage::ConnectionPool::close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (DBConnection* conn : all_) {
+        closeConnection(conn);
+    }
+    all_.clear();
+    free_.clear();
+    stats_.pool_size = 0;
+}
+
+DBConnection* SQLiteStorage::ConnectionPool::acquire() {
+    auto start = std::chrono::steady_clock::now();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (all_.empty()) {
+        LOG_ERROR("Database pool is not initialized");
+        return nullptr;
+    }
+
+    bool contended = free_.empty();
+    cond_.wait(lock, [this] { return !free_.empty(); });
+
+    DBConnection* conn = free_.back();
+    free_.pop_back();
+
+    double wait_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    db_pool_wait_seconds.observe(wait_ms / 1000.0);
+    stats_.checkouts++;
+    stats_.total_wait_ms += wait_ms;
+    if (contended) {
+        stats_.contended_checkouts++;
+    }
+    if (wait_ms > stats_.max_wait_ms) {
+        stats_.max_wait_ms = wait_ms;
+    }
+    lock.unlock();
+
+    if (wait_ms > DB_POOL_SLOW_WAIT_MS) {
+        LOG_WARN("Waited %.1f ms for a database connection", wait_ms);
+    }
+    return conn;
+}
+
+void SQLiteStorage::ConnectionPool::release(DBConnection* conn) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(conn);
+    }
+    cond_.notify_one();
+}
+
+DBPoolStats SQLiteStorage::ConnectionPool::stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    DBPoolStats result = stats_;
+    result.available = free_.size();
+    return result;
+}
+
+bool SQLiteStorage::GroupCommitter::start(DBConnection* conn, size_t max_batch_size, int max_wait_ms,
+                                          OwnVersions& own_versions, PeerChannel& peers) {
+    conn_ = conn;
+    own_versions_ = &own_versions;
+    peers_ = &peers;
+    max_batch_size_ = max_batch_size > 0 ? max_batch_size : 1;
+    max_wait_ = std::chrono::milliseconds(max_wait_ms > 0 ? max_wait_ms : 0);
+    stopping_ = false;
+    writer_ = std::thread(&GroupCommitter::run, this);
+    return true;
+}
+
+void SQLiteStorage::GroupCommitter::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cond_.notify_all();
+    if (writer_.joinable()) {
+        writer_.join();
+    }
+    if (conn_) {
+        closeConnection(conn_);
+        conn_ = nullptr;
+    }
+}
+
+bool SQLiteStorage::GroupCommitter::submit(const std::vector<DBMutation>& mutations) {
+    if (mutations.empty()) {
+        return true;
+    }
+
+    PendingWrite pending;
+    pending.mutations = mutations;
+    return submit(pending) == DBWriteResult::Ok;
+}
+
+DBWriteResult SQLiteStorage::GroupCommitter::submitVersioned(const std::string& user_id, int64_t expected_version,
+                                                             const std::vector<DBMutation>& mutations, int64_t& new_version) {
+    PendingWrite pending;
+    pending.mutations = mutations;
+    pending.user_id = user_id;
+    pending.expected_version = expected_version;
+    DBWriteResult result = submit(pending);
+    new_version = pending.new_version;
+    return result;
+}
+
+DBWriteResult SQLiteStorage::GroupCommitter::submit(PendingWrite& pending) {
+    std::future<DBWriteResult> result = pending.done.get_future();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!writer_.joinable() || stopping_) {
+            LOG_ERROR("Database writer is not running");
+            return DBWriteResult::Failed;
+        }
+        queue_.push_back(&pending);
+        queued_mutations_ += pending.mutations.size();
+    }
+    cond_.notify_all();
+
+    // Acknowledge only once the batch holding these mutations is committed
+    ScopedTimer timer(db_write_seconds);
+    return result.get();
+}
+
+void SQLiteStorage::GroupCommitter::run() {
+    std::vector<PendingWrite*> batch;
+
+    for (;;) {
+        // Counted while dequeuing, acknowledged writers free their PendingWrite right after commit
+        size_t batch_mutations = 0;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this] { return !queue_.empty() || stopping_; });
+            if (queue_.empty()) {
+                break;  // stopping and fully drained
+            }
+
+            // Give concurrent handlers a moment to join the batch
+            auto deadline = std::chrono::steady_clock::now() + max_wait_;
+            cond_.wait_until(lock, deadline, [this] {
+                return queued_mutations_ >= max_batch_size_ || stopping_;
+            });
+
+            // Take whole writes until the batch is full (a single oversized write still goes alone)
+            while (!queue_.empty()) {
+                size_t next = queue_.front()->mutations.size();
+                if (!batch.empty() && batch_mutations + next > max_batch_size_) {
+                    break;
+                }
+                batch.push_back(queue_.front());
+                queue_.pop_front();
+                batch_mutations += next;
+            }
+            queued_mutations_ -= batch_mutations;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        bool ok = applyBatch(batch);
+        double commit_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        db_commit_seconds.observe(commit_ms / 1000.0);
+        db_batch_size.observe(static_cast<double>(batch_mutations));
+        if (!ok) {
+            db_errors.inc();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            stats_.batches++;
+            stats_.mutations += batch_mutations;
+            stats_.total_commit_ms += commit_ms;
+            if (!ok) {
+                stats_.failed_batches++;
+            }
+            if (batch_mutations > stats_.max_batch_size) {
+                stats_.max_batch_size = batch_mutations;
+            }
+        }
+        batch.clear();
+    }
+}
+
+bool SQLiteStorage::GroupCommitter::applyBatch(std::vector<PendingWrite*>& batch) {
+    batch_versions_.clear();
+    if (exec("BEGIN IMMEDIATE")) {
+        bool ok = true;
+        for (PendingWrite* pending : batch) {
+            pending->result = applyWrite(*pending);
+            if (pending->result == DBWriteResult::Failed) {
+                ok = false;
+                break;
+            }
+        }
+
+        if (ok && ++batches_since_prune_ >= DB_DELTA_PRUNE_BATCHES) {
+            batches_since_prune_ = 0;
+            ok = pruneDeltas();
+        }
+
+        if (ok && exec("COMMIT")) {
+            for (PendingWrite* pending : batch) {
+                if (pending->result == DBWriteResult::Conflict) {
+                    db_version_conflicts.inc();
+                    LOG_DEBUG("Version conflict for %s, expected %lld", pending->user_id.c_str(),
+                              static_cast<long long>(pending->expected_version));
+                    pending->done.set_value(DBWriteResult::Conflict);
+                    continue;
+                }
+                for (const DBMutation& m : pending->mutations) {
+                    if (m.remove) {
+                        LOG_DEBUG("Deleted from DB for %s: %s", m.user_id.c_str(), m.currency.c_str());
+                    } else {
+                        LOG_DEBUG("Saved to DB for %s: %s = %g", m.user_id.c_str(), m.currency.c_str(), m.amount);
+                    }
+                }
+                pending->done.set_value(DBWriteResult::Ok);
+            }
+            peers_->notify();
+            return true;
+        }
+        exec("ROLLBACK");
+        // Rolled back versions may be handed out again, possibly to another process
+        own_versions_->remove(batch_versions_);
+    }
+
+    if (batch.size() == 1) {
+        batch[0]->done.set_value(DBWriteResult::Failed);
+        return false;
+    }
+
+    // One bad write must not fail its neighbours, retry each in its own transaction
+    LOG_WARN("Group commit of %zu writes failed, retrying individually", batch.size());
+    for (PendingWrite* pending : batch) {
+        std::vector<PendingWrite*> single = {pending};
+        applyBatch(single);
+    }
+    return false;
+}
+
+// Inside the batch transaction: check the owner's version, write, then give every touched user a new version
+DBWriteResult SQLiteStorage::GroupCommitter::applyWrite(PendingWrite& pending) {
+    if (pending.expected_version >= 0) {
+        int64_t current = 0;
+        if (!readVersion(pending.user_id, current)) {
+            return DBWriteResult::Failed;
+        }
+        if (current != pending.expected_version) {
+            return DBWriteResult::Conflict;
+        }
+    }
+
+    TotalsDeltas deltas;
+    if (!applyMutations(pending.mutations, deltas)) {
+        return DBWriteResult::Failed;
+    }
+
+    if (!pending.user_id.empty()) {
+        return bumpVersion(pending.user_id, pending.new_version) &&
+               writeDeltas(pending.user_id, pending.new_version, deltas) ? DBWriteResult::Ok : DBWriteResult::Failed;
+    }
+    std::unordered_set<std::string> touched;
+    for (const DBMutation& m : pending.mutations) {
+        int64_t version = 0;
+        if (touched.insert(m.user_id).second &&
+            (!bumpVersion(m.user_id, version) || !writeDeltas(m.user_id, version, deltas))) {
+            return DBWriteResult::Failed;
+        }
+    }
+    return DBWriteResult::Ok;
+}
+
+bool SQLiteStorage::GroupCommitter::readAmount(const std::string& user_id, const std::string& currency, bool& exists, double& amount) {
+    sqlite3_stmt* stmt = conn_->amount_stmt;
+    sqlite3_bind_text(stmt, 1, user_id.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 2, currency.c_str(), -1, SQLITE_TRANSIENT);
+    int rc = sqlite3_step(stmt);
+    exists = rc == SQLITE_ROW;
+    amount = exists ? sqlite3_column_double(stmt, 0) : 0.0;
+    if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
+        LOG_ERROR("Failed to read balance: %s", sqlite3_errmsg(conn_->db));
+    }
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    return rc == SQLITE_ROW || rc == SQLITE_DONE;
+}
+
+// Deltas of one user's commit, under its version, so other processes can update their totals without a scan
+bool SQLiteStorage::GroupCommitter::writeDeltas(const std::string& user_id, int64_t version, const TotalsDeltas& deltas) {
+    sqlite3_stmt* stmt = conn_->delta_stmt;
+    for (auto it = deltas.lower_bound({user_id, ""}); it != deltas.end() && it->first.first == user_id; ++it) {
+        const auto& [amount, holders] = it->second;
+        if (amount == 0.0 && holders == 0) {
+            continue;
+        }
+        sqlite3_bind_int64(stmt, 1, version);
+        sqlite3_bind_text(stmt, 2, it->first.second.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_double(stmt, 3, amount);
+        sqlite3_bind_int64(stmt, 4, holders);
+        int rc = sqlite3_step(stmt);
+        if (rc != SQLITE_DONE) {
+            LOG_ERROR("Failed to record totals delta: %s", sqlite3_errmsg(conn_->db));
+        }
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+        if (rc != SQLITE_DONE) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Keep the deltas of the last DB_DELTA_RETAIN versions, a process further behind reloads its totals
+bool SQLiteStorage::GroupCommitter::pruneDeltas() {
+    if (batch_versions_.empty()) {
+        return true;
+    }
+    int64_t through = batch_versions_.back() - DB_DELTA_RETAIN;
+    if (through <= 0) {
+        return true;
+    }
+    std::string through_text = std::to_string(through);
+    std::string sql = "DELETE FROM wallet_delta WHERE seq <= " + through_text + ";"
+                      "REPLACE INTO wallet_meta (name, value) VALUES ('delta_pruned_through', " + through_text + ");";
+    return exec(sql.c_str());
+}
+
+bool SQLiteStorage::GroupCommitter::readVersion(const std::string& user_id, int64_t& version) {
+    sqlite3_stmt* stmt = conn_->version_stmt;
+    sqlite3_bind_text(stmt, 1, user_id.c_str(), -1, SQLITE_TRANSIENT);
+    int rc = sqlite3_step(stmt);
+    version = rc == SQLITE_ROW ? sqlite3_column_int64(stmt, 0) : 0;
+    if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
+        LOG_ERROR("Failed to read wallet version: %s", sqlite3_errmsg(conn_->db));
+    }
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    return rc == SQLITE_ROW || rc == SQLITE_DONE;
+}
+
+bool SQLiteStorage::GroupCommitter::bumpVersion(const std::string& user_id, int64_t& version) {
+    sqlite3_stmt* stmt = conn_->bump_stmt;
+    sqlite3_bind_text(stmt, 1, user_id.c_str(), -1, SQLITE_TRANSIENT);
+    int rc = sqlite3_step(stmt);
+    if (rc == SQLITE_DONE) {
+        version = sqlite3_last_insert_rowid(conn_->db);
+        // Recorded before COMMIT: the feed may see the commit before this thread returns from it
+        batch_versions_.push_back(version);
+        own_versions_->add(version);
+    } else {
+        LOG_ERROR("Failed to bump wallet version: %s", sqlite3_errmsg(conn_->db));
+    }
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    return rc == SQLITE_DONE;
+}
+
+bool SQLiteStorage::GroupCommitter::applyMutations(const std::vector<DBMutation>& mutations, TotalsDeltas& deltas) {
+    for (const DBMutation& m : mutations) {
+        // The row as it was, to tell what this write changes in the totals
+        bool exists = false;
+        double previous = 0.0;
+        if (!readAmount(m.user_id, m.currency, exists, previous)) {
+            return false;
+        }
+        auto& [amount, holders] = deltas[{m.user_id, m.currency}];
+        if (m.remove) {
+            amount -= previous;
+            holders -= exists ? 1 : 0;
+        } else {
+            amount += m.amount - previous;
+            holders += exists ? 0 : 1;
+        }
+
+        sqlite3_stmt* stmt = m.remove ? conn_->delete_stmt : conn_->replace_stmt;
+
+        sqlite3_bind_text(stmt, 1, m.user_id.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt, 2, m.currency.c_str(), -1, SQLITE_TRANSIENT);
+        if (!m.remove) {
+            sqlite3_bind_double(stmt, 3, m.amount);
+        }
+
+        int rc = sqlite3_step(stmt);
+        if (rc != SQLITE_DONE) {
+            LOG_ERROR("Failed to execute: %s", sqlite3_errmsg(conn_->db));
+        }
+
+        // Make statement ready for the next use
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+
+        if (rc != SQLITE_DONE) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SQLiteStorage::GroupCommitter::exec(const char* sql) {
+    char* errMsg = nullptr;
+    if (sqlite3_exec(conn_->db, sql, nullptr, nullptr, &errMsg) != SQLITE_OK) {
+        LOG_ERROR("SQL error (%s): %s", sql, errMsg);
+        sqlite3_free(errMsg);
+        return false;
+    }
+    return true;
+}
+
+DBCommitStats SQLiteStorage::GroupCommitter::stats() {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    return stats_;
+}
+
+void SQLiteStorage::OwnVersions::add(int64_t version) {
+    if (enabled_.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        versions_.insert(version);
+    }
+}
+
+void SQLiteStorage::OwnVersions::remove(const std::vector<int64_t>& versions) {
+    if (enabled_.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (int64_t version : versions) {
+            versions_.erase(version);
+        }
+    }
+}
+
+bool SQLiteStorage::OwnVersions::contains(int64_t version) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return versions_.count(version) > 0;
+}
+
+void SQLiteStorage::OwnVersions::dropThrough(int64_t version) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = versions_.begin(); it != versions_.end();) {
+        it = *it <= version ? versions_.erase(it) : std::next(it);
+    }
+}
+
+bool SQLiteStorage::PeerChannel::open(const std::string& dir) {
+    if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) {
+        LOG_WARN("Failed to create %s: %s", dir.c_str(), strerror(errno));
+        return false;
+    }
+
+    dir_ = dir;
+    fd_ = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd_ < 0) {
+        LOG_WARN("Failed to create peer socket: %s", strerror(errno));
+        return false;
+    }
+
+    // The pid alone is not unique: processes in separate containers sharing the directory are all pid 1
+    // A random suffix keeps names apart, and an existing socket is never replaced since it may be live
+    std::random_device random;
+    std::string path;
+    for (int attempt = 0; attempt < 3; attempt++) {
+        char name[64];
+        snprintf(name, sizeof(name), "%ld-%08x%08x.sock", static_cast<long>(getpid()), random(), random());
+        own_name_ = name;
+        path = dir_ + "/" + own_name_;
+        sockaddr_un addr{};
+        if (path.size() >= sizeof(addr.sun_path)) {
+            LOG_WARN("Peer socket path too long, relying on polling: %s", path.c_str());
+            break;
+        }
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+        if (bind(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) {
+            return true;
+        }
+        if (errno != EADDRINUSE) {
+            LOG_WARN("Failed to bind peer socket %s: %s", path.c_str(), strerror(errno));
+            break;
+        }
+    }
+
+    ::close(fd_);
+    fd_ = -1;
+    return false;
+}
+
+void SQLiteStorage::PeerChannel::close() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+        unlink((dir_ + "/" + own_name_).c_str());
+        fd_ = -1;
+    }
+}
+
+void SQLiteStorage::PeerChannel::notify() {
+    if (fd_ < 0) {
+        return;
+    }
+    DIR* dir = opendir(dir_.c_str());
+    if (dir == nullptr) {
+        return;
+    }
+
+    static const char poke = 1;
+    while (dirent* entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name == own_name_ || name.size() < 6 || name.compare(name.size() - 5, 5, ".sock") != 0) {
+            continue;
+        }
+        std::string path = dir_ + "/" + name;
+        sockaddr_un addr{};
+        if (path.size() >= sizeof(addr.sun_path)) {
+            continue;
+        }
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+        // A full buffer means the peer has pokes pending already
+        if (sendto(fd_, &poke, 1, MSG_DONTWAIT, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 &&
+            errno == ECONNREFUSED) {
+            LOG_INFO("Removing peer socket of a stopped process: %s", name.c_str());
+            unlink(path.c_str());
+        }
+    }
+    closedir(dir);
+}
+
+bool SQLiteStorage::PeerChannel::drain() {
+    if (fd_ < 0) {
+        return false;
+    }
+    bool any = false;
+    char buffer[64];
+    while (recv(fd_, buffer, sizeof(buffer), MSG_DONTWAIT) > 0) {
+        any = true;
+    }
+    return any;
+}
+
+bool SQLiteStorage::ChangeFeed::start(const std::string& path, OwnVersions& own_versions, PeerChannel& peers,
+                                      int64_t since_version, int interval_ms, DBChangeCallback on_change) {
+    own_versions_ = &own_versions;
+    peers_ = &peers;
+    conn_ = openConnection(path);
+    if (!conn_) {
+        return false;
+    }
+    if (sqlite3_prepare_v2(conn_->db, "PRAGMA data_version", -1, &data_version_stmt_, nullptr) != SQLITE_OK ||
+        sqlite3_prepare_v2(conn_->db, "SELECT seq, user_id FROM wallet_version WHERE seq > ? ORDER BY seq", -1,
+                           &changes_stmt_, nullptr) != SQLITE_OK ||
+        sqlite3_prepare_v2(conn_->db, "SELECT value FROM wallet_meta WHERE name = 'delta_pruned_through'", -1,
+                           &pruned_stmt_, nullptr) != SQLITE_OK ||
+        sqlite3_prepare_v2(conn_->db, "SELECT seq, currency_code, amount, holders FROM wallet_delta "
+                           "WHERE seq > ? AND seq <= ?", -1, &deltas_stmt_, nullptr) != SQLITE_OK) {
+        LOG_ERROR("Failed to prepare statement: %s", sqlite3_errmsg(conn_->db));
+        stop();
+        return false;
+    }
+
+    last_version_ = since_version;
+    own_versions_->enable();
+    interval_ms_ = interval_ms > 0 ? interval_ms : DB_SYNC_INTERVAL_MS;
+    on_change_ = std::move(on_change);
+    stopping_ = false;
+    thread_ = std::thread(&ChangeFeed::run, this);
+    return true;
+}
+
+void SQLiteStorage::ChangeFeed::stop() {
+    stopping_ = true;
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    sqlite3_finalize(data_version_stmt_);
+    sqlite3_finalize(changes_stmt_);
+    sqlite3_finalize(pruned_stmt_);
+    sqlite3_finalize(deltas_stmt_);
+    data_version_stmt_ = nullptr;
+    changes_stmt_ = nullptr;
+    pruned_stmt_ = nullptr;
+    deltas_stmt_ = nullptr;
+    if (conn_) {
+        closeConnection(conn_);
+        conn_ = nullptr;
+    }
+}
+
+void SQLiteStorage::ChangeFeed::run() {
+    int64_t data_version = -1;
+    while (!stopping_) {
+        // A peer's poke ends the wait early, polling covers lost pokes
+        pollfd poke{peers_->fd(), POLLIN, 0};
+        poll(&poke, poke.fd >= 0 ? 1 : 0, interval_ms_);
+        peers_->drain();
+
+        // data_version only moves when another connection committed, checking it is cheap
+        int64_t current = data_version;
+        if (sqlite3_step(data_version_stmt_) == SQLITE_ROW) {
+            current = sqlite3_column_int64(data_version_stmt_, 0);
+        }
+        sqlite3_reset(data_version_stmt_);
+        if (current == data_version) {
+            continue;
+        }
+        data_version = current;
+
+        DBChanges changes;
+        int64_t latest = last_version_;
+        if (!readChanges(changes, latest)) {
+            LOG_ERROR("Failed to read wallet changes: %s", sqlite3_errmsg(conn_->db));
+            db_errors.inc();
+            data_version = -1;  // try again next round
+            continue;
+        }
+        // Every version of ours up to latest is committed or rolled back by now
+        own_versions_->dropThrough(latest);
+        last_version_ = latest;
+
+        if (!changes.wallets.empty() || !changes.totals_complete) {
+            db_changes_seen.inc(changes.wallets.size());
+            on_change_(changes);
+        }
+    }
+}
+
+// Wallets written after last_version_ and their totals deltas, from one snapshot
+bool SQLiteStorage::ChangeFeed::readChanges(DBChanges& changes, int64_t& latest) {
+    if (sqlite3_exec(conn_->db, "BEGIN", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        return false;
+    }
+
+    // A wallet written twice only shows its latest version here, the deltas below have both
+    sqlite3_bind_int64(changes_stmt_, 1, last_version_);
+    int rc;
+    while ((rc = sqlite3_step(changes_stmt_)) == SQLITE_ROW) {
+        int64_t version = sqlite3_column_int64(changes_stmt_, 0);
+        latest = version;
+        if (own_versions_->contains(version)) {
+            continue;
+        }
+        const char* user_id = reinterpret_cast<const char*>(sqlite3_column_text(changes_stmt_, 1));
+        changes.wallets.push_back({std::string(user_id, sqlite3_column_bytes(changes_stmt_, 1)), version});
+    }
+    sqlite3_reset(changes_stmt_);
+
+    if (rc == SQLITE_DONE && latest > last_version_) {
+        rc = sqlite3_step(pruned_stmt_);
+        int64_t pruned_through = rc == SQLITE_ROW ? sqlite3_column_int64(pruned_stmt_, 0) : 0;
+        sqlite3_reset(pruned_stmt_);
+        if (rc == SQLITE_ROW || rc == SQLITE_DONE) {
+            rc = SQLITE_DONE;
+            changes.totals_complete = pruned_through <= last_version_;
+        }
+    }
+
+    if (rc == SQLITE_DONE && latest > last_version_ && changes.totals_complete) {
+        sqlite3_bind_int64(deltas_stmt_, 1, last_version_);
+        sqlite3_bind_int64(deltas_stmt_, 2, latest);
+        while ((rc = sqlite3_step(deltas_stmt_)) == SQLITE_ROW) {
+            int64_t version = sqlite3_column_int64(deltas_stmt_, 0);
+            const char* currency = reinterpret_cast<const char*>(sqlite3_column_text(deltas_stmt_, 1));
+            CurrencyCode code = CurrencyCode::fromChars(currency, sqlite3_column_bytes(deltas_stmt_, 1));
+            if (own_versions_->contains(version) || !code.valid()) {
+                continue;
+            }
+            changes.totals.push_back({version, code, sqlite3_column_double(deltas_stmt_, 2),
+                                      sqlite3_column_int64(deltas_stmt_, 3)});
+        }
+        sqlite3_reset(deltas_stmt_);
+    }
+
+    sqlite3_exec(conn_->db, "COMMIT", nullptr, nullptr, nullptr);
+    return rc == SQLITE_DONE;
+}
+
+SQLiteStorage::SQLiteStorage(const std::string& path, size_t max_batch_size, int max_wait_ms)
+    : path_(path), max_batch_size_(max_batch_size), max_wait_ms_(max_wait_ms),
+      pool_(std::make_unique<ConnectionPool>()), committer_(std::make_unique<GroupCommitter>()),
+      own_versions_(std::make_unique<OwnVersions>()), peers_(std::make_unique<PeerChannel>()),
+      change_feed_(std::make_unique<ChangeFeed>()) {}
+
+SQLiteStorage::~SQLiteStorage() = default;
+
+bool SQLiteStorage::open() {
+    sqlite3* db;
+    char* errMsg = nullptr;
+
+    // Open database (create if not exist)
+    int rc = sqlite3_open(path_.c_str(), &db);
+    if (rc != SQLITE_OK) {
+        LOG_ERROR("Failed to open database: %s", sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return false;
+    }
+
+    // Another process may be creating the tables at the same time
+    sqlite3_busy_timeout(db, 5000);
+
+    // Create SQL table
+    const char* sql =
+        "CREATE TABLE IF NOT EXISTS wallet ("
+        "    user_id TEXT NOT NULL,"
+        "    currency_code TEXT NOT NULL,"
+        "    amount REAL NOT NULL,"
+        "    PRIMARY KEY (user_id, currency_code)"
+        ");"
+        // Version of each wallet: the seq of its latest write, unique across the database
+        "CREATE TABLE IF NOT EXISTS wallet_version ("
+        "    seq INTEGER PRIMARY KEY AUTOINCREMENT,"
+        "    user_id TEXT NOT NULL UNIQUE"
+        ");"
+        // What each version changed in the per-currency totals, read by the other processes' change feeds
+        "CREATE TABLE IF NOT EXISTS wallet_delta ("
+        "    seq INTEGER NOT NULL,"
+        "    currency_code TEXT NOT NULL,"
+        "    amount REAL NOT NULL,"
+        "    holders INTEGER NOT NULL,"
+        "    PRIMARY KEY (seq, currency_code)"
+        ") WITHOUT ROWID;"
+        "CREATE TABLE IF NOT EXISTS wallet_meta ("
+        "    name TEXT PRIMARY KEY,"
+        "    value INTEGER NOT NULL"
+        ");";
+
+    // Execute SQL
+    rc = sqlite3_exec(db, sql, nullptr, nullptr, &errMsg);
+    if (rc == SQLITE_OK) {
+        // WAL lets the pooled readers run while the writer commits (persistent for the file)
+        rc = sqlite3_exec(db, "PRAGMA journal_mode=WAL;", nullptr, nullptr, &errMsg);
+    }
+    if (rc != SQLITE_OK) {
+        LOG_ERROR("SQL error: %s", errMsg);
+        sqlite3_free(errMsg);
+        sqlite3_close(db);
+        return false;
+    }
+
+    sqlite3_close(db);
+
+    // Table must exist before statements can be prepared on pooled connections
+    if (!pool_->open(path_, DB_POOL_SIZE)) {
+        LOG_ERROR("Failed to open database connection pool");
+        pool_->close();
+        return false;
+    }
+
+    // Dedicated connection for the writer thread
+    DBConnection* writer_conn = openConnection(path_);
+    if (!writer_conn) {
+        pool_->close();
+        return false;
+    }
+
+    // Other processes on this host are told about commits through the peer directory
+    peers_->open(path_ + ".peers");
+
+    // WAL defaults to NORMAL which may lose the last commits on power loss, acknowledged writes must survive
+    sqlite3_exec(writer_conn->db, "PRAGMA synchronous=FULL;", nullptr, nullptr, nullptr);
+    committer_->start(writer_conn, max_batch_size_, max_wait_ms_, *own_versions_, *peers_);
+
+    LOG_INFO("Database initialized successfully (%d pooled connections, group commit up to %zu writes / %d ms)",
+             DB_POOL_SIZE, max_batch_size_, max_wait_ms_);
+    return true;
+}
+
+void SQLiteStorage::close() {
+    change_feed_->stop();
+    committer_->stop();
+    peers_->close();
+    pool_->close();
+}
+
+bool SQLiteStorage::loadWallet(const std::string& user_id, Balances& wallet, int64_t& version) {
+    ScopedTimer timer(db_load_seconds);
+    PooledConnection conn(*pool_);
+    if (!conn) {
+        db_errors.inc();
+        return false;
+    }
+
+    // Rows and version from the same snapshot
+    char* errMsg = nullptr;
+    if (sqlite3_exec(conn->db, "BEGIN", nullptr, nullptr, &errMsg) != SQLITE_OK) {
+        LOG_ERROR("SQL error (BEGIN): %s", errMsg);
+        sqlite3_free(errMsg);
+        db_errors.inc();
+        return false;
+    }
+
+    sqlite3_stmt* stmt = conn->select_stmt;
+
+    // Add user_id
+    sqlite3_bind_text(stmt, 1, user_id.c_str(), -1, SQLITE_TRANSIENT);
+
+    wallet.clear();
+
+    // Go through results
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        const char* currency = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        double amount = sqlite3_column_double(stmt, 1);
+
+        CurrencyCode code = CurrencyCode::fromChars(currency, sqlite3_column_bytes(stmt, 0));
+        if (!code.valid()) {
+            LOG_WARN("Skipping invalid currency code for %s: %s", user_id.c_str(), currency);
+            continue;
+        }
+        wallet[code] = amount;
+        LOG_DEBUG("Loaded for %s: %s = %g", user_id.c_str(), currency, amount);
+    }
+
+    if (rc != SQLITE_DONE) {
+        LOG_ERROR("Failed to execute: %s", sqlite3_errmsg(conn->db));
+        db_errors.inc();
+    }
+
+    // Make statement ready for the next use
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+
+    if (rc == SQLITE_DONE) {
+        sqlite3_stmt* version_stmt = conn->version_stmt;
+        sqlite3_bind_text(version_stmt, 1, user_id.c_str(), -1, SQLITE_TRANSIENT);
+        rc = sqlite3_step(version_stmt);
+        version = rc == SQLITE_ROW ? sqlite3_column_int64(version_stmt, 0) : 0;
+        if (rc == SQLITE_ROW) {
+            rc = SQLITE_DONE;
+        } else if (rc != SQLITE_DONE) {
+            LOG_ERROR("Failed to read wallet version: %s", sqlite3_errmsg(conn->db));
+            db_errors.inc();
+        }
+        sqlite3_reset(version_stmt);
+        sqlite3_clear_bindings(version_stmt);
+    }
+    sqlite3_exec(conn->db, "COMMIT", nullptr, nullptr, nullptr);
+
+    if (rc != SQLITE_DONE) {
+        return false;
+    }
+
+    LOG_DEBUG("Loaded %zu currencies for user %s", wallet.size(), user_id.c_str());
+    return true;
+}
+
+bool SQLiteStorage::loadAllWallets(const WalletScanFn& fn) {
+    ScopedTimer timer(db_scan_seconds);
+    PooledConnection conn(*pool_);
+    if (!conn) {
+        db_errors.inc();
+        return false;
+    }
+
+    // No ORDER BY: walk the table in storage order and group by user here
+    sqlite3_stmt* stmt = nullptr;
+    const char* sql = "SELECT w.user_id, w.currency_code, w.amount, IFNULL(v.seq, 0) FROM wallet w "
+                      "LEFT JOIN wallet_version v ON v.user_id = w.user_id";
+    if (sqlite3_prepare_v2(conn->db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        LOG_ERROR("Failed to prepare statement: %s", sqlite3_errmsg(conn->db));
+        db_errors.inc();
+        return false;
+    }
+
+    struct ScannedWallet {
+        Balances balances;
+        int64_t version = 0;
+    };
+    std::unordered_map<std::string, ScannedWallet> wallets;
+    size_t rows = 0;
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        const char* user_id = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        const char* currency = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        double amount = sqlite3_column_double(stmt, 2);
+
+        CurrencyCode code = CurrencyCode::fromChars(currency, sqlite3_column_bytes(stmt, 1));
+        if (!code.valid()) {
+            LOG_WARN("Skipping invalid currency code for %s: %s", user_id, currency);
+            continue;
+        }
+        ScannedWallet& wallet = wallets[std::string(user_id, sqlite3_column_bytes(stmt, 0))];
+        wallet.balances[code] = amount;
+        wallet.version = sqlite3_column_int64(stmt, 3);
+        rows++;
+    }
+
+    if (rc != SQLITE_DONE) {
+        LOG_ERROR("Failed to execute: %s", sqlite3_errmsg(conn->db));
+        db_errors.inc();
+    }
+    sqlite3_finalize(stmt);
+
+    if (rc != SQLITE_DONE) {
+        return false;
+    }
+
+    for (auto& [user_id, wallet] : wallets) {
+        fn(user_id, wallet.balances, wallet.version);
+    }
+
+    LOG_DEBUG("Scanned %zu rows for %zu wallets", rows, wallets.size());
+    return true;
+}
+
+bool SQLiteStorage::loadCurrencyTotals(const CurrencyTotalsFn& fn, int64_t& version) {
+    ScopedTimer timer(db_totals_seconds);
+    PooledConnection conn(*pool_);
+    if (!conn) {
+        db_errors.inc();
+        return false;
+    }
+
+    // Totals and the latest version from the same snapshot
+    sqlite3_stmt* version_stmt = nullptr;
+    sqlite3_stmt* stmt = nullptr;
+    const char* version_sql = "SELECT IFNULL(MAX(seq), 0) FROM wallet_version";
+    const char* sql = "SELECT currency_code, SUM(amount), COUNT(*) FROM wallet GROUP BY currency_code";
+    if (sqlite3_prepare_v2(conn->db, version_sql, -1, &version_stmt, nullptr) != SQLITE_OK ||
+        sqlite3_prepare_v2(conn->db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        LOG_ERROR("Failed to prepare statement: %s", sqlite3_errmsg(conn->db));
+        db_errors.inc();
+        sqlite3_finalize(version_stmt);
+        return false;
+    }
+    sqlite3_exec(conn->db, "BEGIN", nullptr, nullptr, nullptr);
+
+    int rc = sqlite3_step(version_stmt);
+    version = rc == SQLITE_ROW ? sqlite3_column_int64(version_stmt, 0) : 0;
+    sqlite3_finalize(version_stmt);
+
+    while (rc == SQLITE_ROW && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        const char* currency = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        CurrencyCode code = CurrencyCode::fromChars(currency, sqlite3_column_bytes(stmt, 0));
+        if (!code.valid()) {
+            LOG_WARN("Skipping invalid currency code in totals: %s", currency);
+            continue;
+        }
+        fn(code, sqlite3_column_double(stmt, 1), sqlite3_column_int64(stmt, 2));
+    }
+
+    if (rc != SQLITE_DONE) {
+        LOG_ERROR("Failed to execute: %s", sqlite3_errmsg(conn->db));
+        db_errors.inc();
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_exec(conn->db, "COMMIT", nullptr, nullptr, nullptr);
+    return rc == SQLITE_DONE;
+}
+
+DBWriteResult SQLiteStorage::commit(const std::string& user_id, int64_t expected_version,
+                                    const std::vector<DBMutation>& mutations, int64_t& new_version) {
+    if (user_id.empty()) {
+        return committer_->submit(mutations) ? DBWriteResult::Ok : DBWriteResult::Failed;
+    }
+    return committer_->submitVersioned(user_id, expected_version, mutations, new_version);
+}
+
+int64_t SQLiteStorage::latestVersion() {
+    PooledConnection conn(*pool_);
+    if (!conn) {
+        db_errors.inc();
+        return 0;
+    }
+    sqlite3_stmt* stmt = nullptr;
+    int64_t version = 0;
+    if (sqlite3_prepare_v2(conn->db, "SELECT IFNULL(MAX(seq), 0) FROM wallet_version", -1, &stmt, nullptr) == SQLITE_OK &&
+        sqlite3_step(stmt) == SQLITE_ROW) {
+        version = sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    return version;
+}
+
+bool SQLiteStorage::startChangeFeed(int64_t since_version, int interval_ms, DBChangeCallback on_change) {
+    return change_feed_->start(path_, *own_versions_, *peers_, since_version, interval_ms, std::move(on_change));
+}
+
+DBPoolStats SQLiteStorage::poolStats() {
+    return pool_->stats();
+}
+
+DBCommitStats SQLiteStorage::commitStats() {
+    return committer_->stats();
+}
@@ -0,0 +1,51 @@
+#ifndef SQLITE_STORAGE_H
+#define SQLITE_STORAGE_H
+
+#include <memory>
+#include "database.h"
+#include "storage.h"
+
+// Wallet table in SQLite (WAL): pooled readers, one group commit writer thread
+// Several processes may share the file, each one follows the others' commits through the change feed
+// The instance owns its pool, writer, peer socket and change feed, it can be opened again after close()
+class SQLiteStorage : public StorageEngine {
+public:
+    SQLiteStorage(const std::string& path, size_t max_batch_size, int max_wait_ms);
+    ~SQLiteStorage() override;
+
+    bool open() override;
+    void close() override;
+
+    bool loadWallet(const std::string& user_id, Balances& wallet, int64_t& version) override;
+    bool loadAllWallets(const WalletScanFn& fn) override;
+    bool loadCurrencyTotals(const CurrencyTotalsFn& fn, int64_t& version) override;
+
+    DBWriteResult commit(const std::string& user_id, int64_t expected_version,
+                         const std::vector<DBMutation>& mutations, int64_t& new_version) override;
+
+    int64_t latestVersion() override;
+    bool startChangeFeed(int64_t since_version, int interval_ms, DBChangeCallback on_change) override;
+
+    DBPoolStats poolStats();
+    DBCommitStats commitStats();
+
+private:
+    class ConnectionPool;
+    class PooledConnection;
+    class GroupCommitter;
+    class OwnVersions;
+    class PeerChannel;
+    class ChangeFeed;
+
+    std::string path_;
+    size_t max_batch_size_;
+    int max_wait_ms_;
+
+    std::unique_ptr<ConnectionPool> pool_;
+    std::unique_ptr<GroupCommitter> committer_;
+    std::unique_ptr<OwnVersions> own_versions_;     // shared by the committer and the change feed
+    std::unique_ptr<PeerChannel> peers_;
+    std::unique_ptr<ChangeFeed> change_feed_;
+};
+
+#endif // SQLITE_STORAGE_H
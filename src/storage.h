@@ -0,0 +1,76 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include "currency.h"
+
+// Single row change applied by the group committer
+struct DBMutation {
+    std::string user_id;
+    std::string currency;
+    double amount;
+    bool remove;    // delete the row instead of writing amount
+};
+
+// Outcome of a versioned wallet write
+enum class DBWriteResult {
+    Ok,
+    Conflict,       // the stored version moved on (another process wrote first), nothing was written
+    Failed
+};
+
+// What one commit changed in the per-currency totals
+struct DBTotalsDelta {
+    int64_t version;    // of the wallet the commit wrote
+    CurrencyCode code;
+    double amount;
+    int64_t holders;    // +1 for a new balance, -1 for a removed one
+};
+
+// Commits by other processes, found by one pass of the change feed
+struct DBChanges {
+    std::vector<std::pair<std::string, int64_t>> wallets;   // (user_id, new version), in commit order
+    std::vector<DBTotalsDelta> totals;                      // what those commits changed in the totals
+    bool totals_complete = true;    // false if the deltas were pruned already, the totals must be loaded again
+};
+
+using DBChangeCallback = std::function<void(const DBChanges& changes)>;
+
+using WalletScanFn = std::function<void(const std::string& user_id, Balances& wallet, int64_t version)>;
+using CurrencyTotalsFn = std::function<void(CurrencyCode code, double amount, int64_t holders)>;
+
+// Where wallets are kept, selected once at startup. database.h forwards to the open engine
+// Every method may be called from any thread between open() and close()
+class StorageEngine {
+public:
+    virtual ~StorageEngine() = default;
+
+    virtual bool open() = 0;
+    // Wait for pending writes and release everything open() acquired
+    virtual void close() = 0;
+
+    // Wallet and its version (0 if it was never written) as of one point in time
+    virtual bool loadWallet(const std::string& user_id, Balances& wallet, int64_t& version) = 0;
+    // Every wallet, fn is called once per user
+    virtual bool loadAllWallets(const WalletScanFn& fn) = 0;
+    // Sum and number of holders of every held currency, fn is called once per currency
+    // version is set to the latest version the totals include
+    virtual bool loadCurrencyTotals(const CurrencyTotalsFn& fn, int64_t& version) = 0;
+
+    // Durably apply mutations as one unit. With a user_id they are that user's and only apply
+    // while the user's version is expected_version, new_version is set to the version after
+    // An empty user_id writes unconditionally. Every touched user gets a new version either way
+    virtual DBWriteResult commit(const std::string& user_id, int64_t expected_version,
+                                 const std::vector<DBMutation>& mutations, int64_t& new_version) = 0;
+
+    // Highest version given out so far
+    virtual int64_t latestVersion() = 0;
+
+    // Report wallets other processes wrote after since_version, stopped by close()
+    virtual bool startChangeFeed(int64_t since_version, int interval_ms, DBChangeCallback on_change) = 0;
+};
+
+#endif // STORAGE_H
@@ -0,0 +1,106 @@
+#include "stream_hub.h"
+#include <algorithm>
+#include "metrics.h"
+
+static Counter& stream_wakeups = metrics().counter(
+    "wallet_stream_wakeups_total", "Streams woken by a wallet or rate change");
+
+StreamSubscription::Wake StreamSubscription::wait(std::chrono::seconds timeout) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!cond_.wait_for(lock, timeout, [this] { return pending_ || closed_; })) {
+        return Wake::Timeout;
+    }
+    if (closed_) {
+        return Wake::Closed;
+    }
+    pending_ = false;
+    return Wake::Changed;
+}
+
+void StreamSubscription::signal() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (pending_) {
+            return;
+        }
+        pending_ = true;
+    }
+    stream_wakeups.inc();
+    cond_.notify_one();
+}
+
+void StreamSubscription::close() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+    }
+    cond_.notify_one();
+}
+
+std::shared_ptr<StreamSubscription> StreamHub::subscribe(const std::string& user_id) {
+    auto subscription = std::make_shared<StreamSubscription>(user_id);
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    if (closed_) {
+        subscription->close();
+        return subscription;
+    }
+    subscribers_[user_id].push_back(subscription);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    return subscription;
+}
+
+void StreamHub::unsubscribe(const std::shared_ptr<StreamSubscription>& subscription) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    auto it = subscribers_.find(subscription->userId());
+    if (it == subscribers_.end()) {
+        return;
+    }
+    auto& list = it->second;
+    auto position = std::find(list.begin(), list.end(), subscription);
+    if (position == list.end()) {
+        return;
+    }
+    list.erase(position);
+    count_.fetch_sub(1, std::memory_order_relaxed);
+    if (list.empty()) {
+        subscribers_.erase(it);
+    }
+}
+
+void StreamHub::notifyUser(const std::string& user_id) {
+    if (count_.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = subscribers_.find(user_id);
+    if (it == subscribers_.end()) {
+        return;
+    }
+    for (const auto& subscription : it->second) {
+        subscription->signal();
+    }
+}
+
+void StreamHub::notifyAll() {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    for (const auto& [user_id, list] : subscribers_) {
+        for (const auto& subscription : list) {
+            subscription->signal();
+        }
+    }
+}
+
+void StreamHub::close() {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    closed_ = true;
+    for (const auto& [user_id, list] : subscribers_) {
+        for (const auto& subscription : list) {
+            subscription->close();
+        }
+    }
+}
+
+StreamHub& streamHub() {
+    static StreamHub hub;
+    return hub;
+}
@@ -0,0 +1,69 @@
+#ifndef STREAM_HUB_H
+#define STREAM_HUB_H
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <chrono>
+#include <unordered_map>
+
+#define STREAM_HEARTBEAT_SEC    15      // comment line sent on idle streams so dead clients are noticed
+
+// One open stream, woken when its user's wallet or the rates change
+class StreamSubscription {
+public:
+    enum class Wake { Changed, Timeout, Closed };
+
+    explicit StreamSubscription(const std::string& user_id) : user_id_(user_id) {}
+
+    // Block until there is a change to send, the timeout passes or the hub closes
+    // Changes that arrive while the stream is busy are merged into one wake-up
+    Wake wait(std::chrono::seconds timeout);
+
+    const std::string& userId() const { return user_id_; }
+
+private:
+    friend class StreamHub;
+
+    void signal();
+    void close();
+
+    std::string user_id_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool pending_ = true;       // the current state is sent right after subscribing
+    bool closed_ = false;
+};
+
+// Fans wallet and rate changes out to the open streams
+// Idle streams sleep on their own condition variable, nothing runs for them between changes
+class StreamHub {
+public:
+    std::shared_ptr<StreamSubscription> subscribe(const std::string& user_id);
+    void unsubscribe(const std::shared_ptr<StreamSubscription>& subscription);
+
+    // The user's balances changed, a single atomic load when nobody streams
+    void notifyUser(const std::string& user_id);
+
+    // New rate snapshot, every stream revalues
+    void notifyAll();
+
+    // End every stream (server shutdown), later subscriptions start closed
+    void close();
+
+    size_t size() const { return count_.load(std::memory_order_relaxed); }
+
+private:
+    mutable std::shared_mutex mutex_;
+    std::unordered_map<std::string, std::vector<std::shared_ptr<StreamSubscription>>> subscribers_;
+    std::atomic<size_t> count_{0};
+    bool closed_ = false;
+};
+
+StreamHub& streamHub();
+
+#endif // STREAM_HUB_H
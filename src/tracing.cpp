@@ -0,0 +1,280 @@
+#include "tracing.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "logger.h"
+#include "metrics.h"
+
+thread_local bool trace_sampled = false;
+
+static Counter& sampled_requests = metrics().counter(
+    "wallet_trace_sampled_requests_total", "Requests picked for tracing");
+static Counter& written_spans = metrics().counter(
+    "wallet_trace_spans_total", "Spans written to the trace file");
+static Counter& dropped_spans = metrics().counter(
+    "wallet_trace_spans_dropped_total", "Spans discarded because their thread's buffer was full");
+
+// Finished span, request_id is copied so the event doesn't depend on the request outliving it
+struct TraceEvent {
+    const char* name;
+    uint64_t start_us;
+    uint64_t duration_us;
+    uint8_t id_length;
+    char request_id[TRACE_REQUEST_ID_MAX];
+};
+
+// Single-producer single-consumer ring: the owning thread appends, the writer thread drains
+struct ThreadBuffer {
+    std::unique_ptr<TraceEvent[]> events;
+    size_t mask = 0;
+    std::atomic<size_t> head{0};        // next slot the owner fills
+    std::atomic<size_t> tail{0};        // next slot the writer reads
+    long tid = 0;
+    std::atomic<bool> exited{false};    // the owner is gone, drop the buffer once drained
+};
+
+// Marks the thread's buffer for removal when the thread exits
+struct ThreadBufferHandle {
+    std::shared_ptr<ThreadBuffer> buffer;
+    ~ThreadBufferHandle() {
+        if (buffer) {
+            buffer->exited.store(true, std::memory_order_release);
+        }
+    }
+};
+
+static std::atomic<bool> running{false};
+static uint64_t sample_threshold = 0;       // sampled if a random 32-bit value is below this
+static size_t buffer_capacity = TRACE_BUFFER_EVENTS;
+static const uint32_t request_id_prefix = std::random_device{}();     // keeps ids apart across restarts
+static std::atomic<uint64_t> request_id_counter{0};
+
+static std::mutex buffers_mutex;
+static std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+
+static FILE* sink = nullptr;
+static bool wrote_event = false;            // only touched by the writer thread
+static std::thread writer_thread;
+static std::mutex writer_mutex;
+static std::condition_variable writer_cond;
+
+static thread_local uint8_t current_id_length = 0;
+static thread_local char current_id[TRACE_REQUEST_ID_MAX];
+
+uint64_t traceNow() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+const char* traceName(const std::string& name) {
+    static std::mutex names_mutex;
+    static std::set<std::string> names;
+    std::lock_guard<std::mutex> lock(names_mutex);
+    return names.insert(name).first->c_str();
+}
+
+static ThreadBuffer* threadBuffer() {
+    thread_local ThreadBufferHandle handle;
+    if (!handle.buffer) {
+        auto buffer = std::make_shared<ThreadBuffer>();
+        buffer->events.reset(new TraceEvent[buffer_capacity]);
+        buffer->mask = buffer_capacity - 1;
+        buffer->tid = syscall(SYS_gettid);
+
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        buffers.push_back(buffer);
+        handle.buffer = std::move(buffer);
+    }
+    return handle.buffer.get();
+}
+
+void traceRecord(const char* name, uint64_t start_us, uint64_t end_us) {
+    ThreadBuffer* buffer = threadBuffer();
+    size_t head = buffer->head.load(std::memory_order_relaxed);
+    if (head - buffer->tail.load(std::memory_order_acquire) > buffer->mask) {
+        dropped_spans.inc();
+        return;
+    }
+
+    TraceEvent& event = buffer->events[head & buffer->mask];
+    event.name = name;
+    event.start_us = start_us;
+    event.duration_us = end_us - start_us;
+    event.id_length = current_id_length;
+    memcpy(event.request_id, current_id, current_id_length);
+
+    // Publish to the writer
+    buffer->head.store(head + 1, std::memory_order_release);
+}
+
+// Head sampling: decided once when the request starts, every span below follows it
+static bool sampleRequest() {
+    thread_local uint64_t state = std::random_device{}() | (static_cast<uint64_t>(syscall(SYS_gettid)) << 32) | 1;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return (state >> 32) < sample_threshold;
+}
+
+// Client ids are written into the trace unescaped, so only plain ones are kept
+static bool usableRequestId(const std::string& id) {
+    if (id.empty() || id.size() > TRACE_REQUEST_ID_MAX) {
+        return false;
+    }
+    for (char c : id) {
+        if (!isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '_' && c != '.' && c != ':') {
+            return false;
+        }
+    }
+    return true;
+}
+
+TraceRequest::TraceRequest(const char* name, const std::string& request_id)
+    : name_(name), previous_sampled_(trace_sampled) {
+    if (usableRequestId(request_id)) {
+        request_id_ = request_id;
+    } else {
+        char generated[32];
+        int length = snprintf(generated, sizeof(generated), "%08x-%llx", request_id_prefix,
+                              static_cast<unsigned long long>(request_id_counter.fetch_add(1, std::memory_order_relaxed)));
+        request_id_.assign(generated, length);
+    }
+
+    trace_sampled = running.load(std::memory_order_relaxed) && sampleRequest();
+    if (trace_sampled) {
+        sampled_requests.inc();
+        current_id_length = static_cast<uint8_t>(request_id_.size());
+        memcpy(current_id, request_id_.data(), request_id_.size());
+        start_us_ = traceNow();
+    }
+}
+
+TraceRequest::~TraceRequest() {
+    if (start_us_ != 0) {
+        traceRecord(name_, start_us_, traceNow());
+    }
+    trace_sampled = previous_sampled_;
+}
+
+// Write out every span published so far, forget buffers of exited threads once empty
+static void drain(std::string& batch) {
+    std::vector<std::shared_ptr<ThreadBuffer>> current;
+    {
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        current = buffers;
+    }
+
+    static const long pid = getpid();
+    char line[512 + TRACE_REQUEST_ID_MAX];
+    uint64_t written = 0;
+
+    for (const std::shared_ptr<ThreadBuffer>& buffer : current) {
+        size_t tail = buffer->tail.load(std::memory_order_relaxed);
+        size_t head = buffer->head.load(std::memory_order_acquire);
+        for (; tail != head; tail++) {
+            const TraceEvent& event = buffer->events[tail & buffer->mask];
+            int n = snprintf(line, sizeof(line),
+                             "%s{\"name\":\"%s\",\"cat\":\"wallet\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,"
+                             "\"pid\":%ld,\"tid\":%ld,\"args\":{\"request_id\":\"%.*s\"}}",
+                             wrote_event ? ",\n" : "", event.name,
+                             static_cast<unsigned long long>(event.start_us),
+                             static_cast<unsigned long long>(event.duration_us),
+                             pid, buffer->tid, static_cast<int>(event.id_length), event.request_id);
+            if (n > 0) {
+                batch.append(line, std::min<size_t>(n, sizeof(line) - 1));
+                wrote_event = true;
+                written++;
+            }
+        }
+        // Hand the slots back to the owner
+        buffer->tail.store(tail, std::memory_order_release);
+    }
+
+    if (!batch.empty()) {
+        fwrite(batch.data(), 1, batch.size(), sink);
+        fflush(sink);
+        batch.clear();
+        written_spans.inc(written);
+    }
+
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    for (size_t i = 0; i < buffers.size();) {
+        ThreadBuffer& buffer = *buffers[i];
+        if (buffer.exited.load(std::memory_order_acquire) &&
+            buffer.tail.load(std::memory_order_relaxed) == buffer.head.load(std::memory_order_acquire)) {
+            buffers[i] = std::move(buffers.back());
+            buffers.pop_back();
+        } else {
+            i++;
+        }
+    }
+}
+
+static void writerLoop() {
+    std::string batch;
+    batch.reserve(64 * 1024);
+
+    std::unique_lock<std::mutex> lock(writer_mutex);
+    while (running.load(std::memory_order_acquire)) {
+        writer_cond.wait_for(lock, std::chrono::milliseconds(TRACE_FLUSH_INTERVAL_MS));
+        lock.unlock();
+        drain(batch);
+        lock.lock();
+    }
+    lock.unlock();
+    drain(batch);
+}
+
+bool startTracer(const TracerConfig& config) {
+    if (config.file.empty() || running.load()) {
+        return true;
+    }
+
+    sink = fopen(config.file.c_str(), "w");
+    if (!sink) {
+        LOG_ERROR("Failed to open trace file %s, tracing disabled", config.file.c_str());
+        return false;
+    }
+    fputs("[\n", sink);
+    wrote_event = false;
+
+    buffer_capacity = 2;
+    while (buffer_capacity < config.buffer_events) {
+        buffer_capacity <<= 1;
+    }
+    double rate = std::min(std::max(config.sample_rate, 0.0), 1.0);
+    sample_threshold = static_cast<uint64_t>(rate * 4294967296.0);
+
+    running.store(true, std::memory_order_release);
+    writer_thread = std::thread(writerLoop);
+    LOG_INFO("Tracing %.2f%% of requests to %s", rate * 100.0, config.file.c_str());
+    return true;
+}
+
+void stopTracer() {
+    {
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        if (!running.exchange(false)) {
+            return;
+        }
+    }
+    writer_cond.notify_one();
+    if (writer_thread.joinable()) {
+        writer_thread.join();
+    }
+    fputs("\n]\n", sink);
+    fclose(sink);
+    sink = nullptr;
+}
@@ -0,0 +1,80 @@
+#ifndef TRACING_H
+#define TRACING_H
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+#define TRACE_SAMPLE_RATE           0.01    // share of requests traced when tracing is on
+#define TRACE_BUFFER_EVENTS         2048    // spans buffered per thread, rounded up to a power of two
+#define TRACE_FLUSH_INTERVAL_MS     250     // how often buffered spans are written out
+#define TRACE_REQUEST_ID_MAX        40      // longer or unusual X-Request-Id values are replaced
+
+struct TracerConfig {
+    std::string file;                       // empty: tracing off
+    double sample_rate = TRACE_SAMPLE_RATE;
+    size_t buffer_events = TRACE_BUFFER_EVENTS;
+};
+
+// Start writing sampled spans to the file as Chrome trace events (chrome://tracing, Perfetto)
+// The file is a JSON array left open at the end, which both viewers accept
+bool startTracer(const TracerConfig& config);
+
+// Write out every buffered span and stop the writer
+void stopTracer();
+
+// Stable copy of a span name, for names built at runtime
+const char* traceName(const std::string& name);
+
+// Sampling decision of the request running on this thread
+extern thread_local bool trace_sampled;
+
+// Microseconds on the steady clock
+uint64_t traceNow();
+
+// Queue a finished span of the current request, dropped if this thread's buffer is full
+void traceRecord(const char* name, uint64_t start_us, uint64_t end_us);
+
+// Scope of one request on the current thread, decides whether it is sampled
+// request_id is the client's X-Request-Id if usable, otherwise a new one
+class TraceRequest {
+public:
+    TraceRequest(const char* name, const std::string& request_id);
+    ~TraceRequest();
+
+    TraceRequest(const TraceRequest&) = delete;
+    TraceRequest& operator=(const TraceRequest&) = delete;
+
+    const std::string& requestId() const { return request_id_; }
+
+private:
+    const char* name_;
+    std::string request_id_;
+    uint64_t start_us_ = 0;
+    bool previous_sampled_;
+};
+
+// Times the enclosing scope when the current request is sampled, costs one flag check otherwise
+// name must outlive the tracer: a string literal or traceName()
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* name) : name_(name), start_us_(trace_sampled ? traceNow() : 0) {}
+    ~TraceSpan() {
+        if (start_us_ != 0) {
+            traceRecord(name_, start_us_, traceNow());
+        }
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    const char* name_;
+    uint64_t start_us_;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SPAN(name) TraceSpan TRACE_CONCAT(trace_span_, __LINE__)(name)
+
+#endif // TRACING_H
@@ -1,6 +1,84 @@
 #include "utils.h"
 #include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <ctime>
 
 double roundTo2Decimals(double value) {
     return std::round(value * 100.0) / 100.0;
-}
\ No newline at end of file
+}
+
+long getEnvInt(const char* name, long default_value) {
+    const char* value = std::getenv(name);
+    if (value == nullptr || *value == '\0') {
+        return default_value;
+    }
+
+    char* end = nullptr;
+    long result = std::strtol(value, &end, 10);
+    if (*end != '\0') {
+        return default_value;
+    }
+    return result;
+}
+
+std::string getEnvString(const char* name, const std::string& default_value) {
+    const char* value = std::getenv(name);
+    if (value == nullptr || *value == '\0') {
+        return default_value;
+    }
+    return value;
+}
+
+// Civil calendar <-> day number (proleptic Gregorian), see H. Hinnant's date algorithms
+static int32_t daysFromCivil(int year, unsigned month, unsigned day) {
+    year -= month <= 2;
+    int era = (year >= 0 ? year : year - 399) / 400;
+    unsigned year_of_era = static_cast<unsigned>(year - era * 400);
+    unsigned day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    unsigned day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + static_cast<int32_t>(day_of_era) - 719468;
+}
+
+bool parseDate(const std::string& text, int32_t& day) {
+    int year = 0;
+    unsigned month = 0;
+    unsigned day_of_month = 0;
+    int consumed = 0;
+    if (text.size() != 10 || sscanf(text.c_str(), "%4d-%2u-%2u%n", &year, &month, &day_of_month, &consumed) != 3 ||
+        consumed != 10 || text[4] != '-' || text[7] != '-') {
+        return false;
+    }
+    if (month < 1 || month > 12 || day_of_month < 1) {
+        return false;
+    }
+    static const unsigned month_days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    unsigned max_day = month_days[month - 1] + (month == 2 && leap ? 1 : 0);
+    if (day_of_month > max_day) {
+        return false;
+    }
+    day = daysFromCivil(year, month, day_of_month);
+    return true;
+}
+
+std::string formatDate(int32_t day) {
+    int32_t z = day + 719468;
+    int32_t era = (z >= 0 ? z : z - 146096) / 146097;
+    unsigned day_of_era = static_cast<unsigned>(z - era * 146097);
+    unsigned year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    int year = static_cast<int>(year_of_era) + era * 400;
+    unsigned day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    unsigned mp = (5 * day_of_year + 2) / 153;
+    unsigned day_of_month = day_of_year - (153 * mp + 2) / 5 + 1;
+    unsigned month = mp < 10 ? mp + 3 : mp - 9;
+    year += month <= 2;
+
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%04d-%02u-%02u", year, month, day_of_month);
+    return buffer;
+}
+
+int32_t currentDay() {
+    return static_cast<int32_t>(time(nullptr) / 86400);
+}
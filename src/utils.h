@@ -1,7 +1,25 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <string>
+#include <cstdint>
+
 // Round double number to 2 decimals
 double roundTo2Decimals(double value);
 
-#endif // UTILS_H
\ No newline at end of file
+// Read integer from environment variable, fallback to default if unset or invalid
+long getEnvInt(const char* name, long default_value);
+
+// Read string from environment variable, fallback to default if unset
+std::string getEnvString(const char* name, const std::string& default_value);
+
+// Parse a YYYY-MM-DD date into days since 1970-01-01, returns false if malformed or not a real date
+bool parseDate(const std::string& text, int32_t& day);
+
+// Days since 1970-01-01 as YYYY-MM-DD
+std::string formatDate(int32_t day);
+
+// Current UTC date as days since 1970-01-01
+int32_t currentDay();
+
+#endif // UTILS_H
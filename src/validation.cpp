@@ -0,0 +1,195 @@
+#include "validation.h"
+#include <charconv>
+#include <cmath>
+#include <cstring>
+
+bool validateWalletOperation(const json& data, WalletOperation& op, json& error_response) {
+    // Check if the fields exist
+    if (!data.is_object() || !data.contains("currency") || !data.contains("amount")) {
+        error_response["error"] = "Missing required fields";
+        error_response["required"] = {"currency", "amount"};
+        return false;
+    }
+
+    if (!data["currency"].is_string() || !data["amount"].is_number()) {
+        error_response["error"] = "Invalid field type";
+        error_response["expected"] = {{"currency", "string"}, {"amount", "number"}};
+        return false;
+    }
+
+    std::string currency = data["currency"];
+    double amount = data["amount"];
+
+    // Check if amount is bigger than 0
+    if (amount <= 0) {
+        error_response["error"] = "Amount must be bigger than 0";
+        error_response["received"] = amount;
+        return false;
+    }
+
+    // Check 3-letter currency code (ISO 4217 standard)
+    if (currency.length() != 3) {
+        error_response["error"] = "Currency code must be 3 characters";
+        error_response["received"] = currency;
+        return false;
+    }
+
+    // Pack into a CurrencyCode, lowercase is converted to uppercase
+    CurrencyCode code = CurrencyCode::fromString(currency);
+    if (!code.valid()) {
+        error_response["error"] = "Currency code must contain only letters";
+        error_response["received"] = currency;
+        return false;
+    }
+
+    op.code = code;
+    op.amount = amount;
+    return true;
+}
+
+// Cursor over the request body for parseWalletOperationFast
+namespace {
+struct BodyReader {
+    const char* pos;
+    const char* end;
+
+    void skipSpace() {
+        while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == '\n' || *pos == '\r')) {
+            pos++;
+        }
+    }
+
+    bool consume(char c) {
+        skipSpace();
+        if (pos < end && *pos == c) {
+            pos++;
+            return true;
+        }
+        return false;
+    }
+
+    // String without escapes, returns its bytes without the quotes
+    bool plainString(const char*& start, size_t& length) {
+        if (!consume('"')) {
+            return false;
+        }
+        start = pos;
+        while (pos < end && *pos != '"') {
+            if (*pos == '\\' || static_cast<unsigned char>(*pos) < 0x20) {
+                return false;
+            }
+            pos++;
+        }
+        if (pos == end) {
+            return false;
+        }
+        length = static_cast<size_t>(pos - start);
+        pos++;
+        return true;
+    }
+
+    // JSON number grammar: -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+    bool number(double& value) {
+        skipSpace();
+        const char* start = pos;
+        const char* p = pos;
+        if (p < end && *p == '-') {
+            p++;
+        }
+        if (p < end && *p == '0') {
+            p++;
+        } else if (p < end && *p >= '1' && *p <= '9') {
+            while (p < end && *p >= '0' && *p <= '9') {
+                p++;
+            }
+        } else {
+            return false;
+        }
+        if (p < end && *p == '.') {
+            p++;
+            if (p == end || *p < '0' || *p > '9') {
+                return false;
+            }
+            while (p < end && *p >= '0' && *p <= '9') {
+                p++;
+            }
+        }
+        if (p < end && (*p == 'e' || *p == 'E')) {
+            p++;
+            if (p < end && (*p == '+' || *p == '-')) {
+                p++;
+            }
+            if (p == end || *p < '0' || *p > '9') {
+                return false;
+            }
+            while (p < end && *p >= '0' && *p <= '9') {
+                p++;
+            }
+        }
+
+        auto result = std::from_chars(start, p, value);
+        if (result.ec != std::errc() || result.ptr != p) {
+            return false;
+        }
+        pos = p;
+        return true;
+    }
+};
+}
+
+bool parseWalletOperationFast(const char* data, size_t size, WalletOperation& op) {
+    BodyReader reader{data, data + size};
+    bool have_currency = false;
+    bool have_amount = false;
+    CurrencyCode code;
+    double amount = 0.0;
+
+    if (!reader.consume('{')) {
+        return false;
+    }
+    for (int field = 0; field < 2; field++) {
+        if (field > 0 && !reader.consume(',')) {
+            return false;
+        }
+
+        const char* key;
+        size_t key_length;
+        if (!reader.plainString(key, key_length) || !reader.consume(':')) {
+            return false;
+        }
+
+        if (key_length == 8 && memcmp(key, "currency", 8) == 0 && !have_currency) {
+            const char* value;
+            size_t value_length;
+            if (!reader.plainString(value, value_length)) {
+                return false;
+            }
+            code = CurrencyCode::fromChars(value, value_length);
+            have_currency = true;
+        } else if (key_length == 6 && memcmp(key, "amount", 6) == 0 && !have_amount) {
+            if (!reader.number(amount)) {
+                return false;
+            }
+            have_amount = true;
+        } else {
+            // Unknown or repeated key
+            return false;
+        }
+    }
+    if (!reader.consume('}')) {
+        return false;
+    }
+    reader.skipSpace();
+    if (reader.pos != reader.end) {
+        return false;
+    }
+
+    // Invalid values are left to the full path so the error response stays the same
+    if (!code.valid() || !std::isfinite(amount) || amount <= 0) {
+        return false;
+    }
+
+    op.code = code;
+    op.amount = amount;
+    return true;
+}
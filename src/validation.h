@@ -0,0 +1,25 @@
+#ifndef VALIDATION_H
+#define VALIDATION_H
+
+#include "../third_party/json.hpp"
+#include "currency.h"
+
+using json = nlohmann::json;
+
+// Validated currency and amount of an add/sub operation
+struct WalletOperation {
+    CurrencyCode code;
+    double amount;
+};
+
+// Check "currency" and "amount" fields: 3-letter ISO 4217 code and amount bigger than 0
+// Returns false and fills error_response (400 body) if the operation is invalid
+bool validateWalletOperation(const json& data, WalletOperation& op, json& error_response);
+
+// Fast path for the usual add/sub body {"currency":"XXX","amount":N}, reads the bytes in place without allocating
+// Returns true only for a flat object with exactly these two keys (any order) holding valid values.
+// Anything else returns false and should go through json::parse + validateWalletOperation,
+// which produces the error messages
+bool parseWalletOperationFast(const char* data, size_t size, WalletOperation& op);
+
+#endif // VALIDATION_H
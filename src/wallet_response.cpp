@@ -0,0 +1,34 @@
+#include "wallet_response.h"
+#include "utils.h"
+#include "logger.h"
+
+json buildWalletResponse(const Balances& wallet, const RateTable& nbp_rates) {
+    json wallet_array = json::array();
+    double total_pln = 0.0;
+
+    for (const Balances::Entry& entry : wallet) {
+        // Check if rate exists for this currency
+        double rate = nbp_rates.get(entry.code);
+        if (rate <= 0.0) {
+            LOG_WARN("No NBP rate found: %s", entry.code.str().c_str());
+            // Skip currencies that are not in NBP Table C
+            continue;
+        }
+
+        double pln_value = entry.amount * rate;
+        total_pln += pln_value;
+
+        json item;
+        item["currency"] = entry.code.str();
+        item["amount"] = roundTo2Decimals(entry.amount);
+        item["rate"] = roundTo2Decimals(rate);
+        item["pln_value"] = roundTo2Decimals(pln_value);
+
+        wallet_array.push_back(item);
+    }
+
+    json response;
+    response["wallet"] = wallet_array;
+    response["total_pln"] = roundTo2Decimals(total_pln);
+    return response;
+}
@@ -0,0 +1,12 @@
+#ifndef WALLET_RESPONSE_H
+#define WALLET_RESPONSE_H
+
+#include "../third_party/json.hpp"
+#include "currency.h"
+
+using json = nlohmann::json;
+
+// GET /wallet body: every currency valued in PLN, currencies without a rate are skipped
+json buildWalletResponse(const Balances& wallet, const RateTable& nbp_rates);
+
+#endif // WALLET_RESPONSE_H
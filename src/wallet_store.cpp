@@ -0,0 +1,245 @@
+#include "wallet_store.h"
+#include <functional>
+#include <algorithm>
+#include "database.h"
+#include "exposure.h"
+#include "stream_hub.h"
+#include "logger.h"
+#include "metrics.h"
+#include "tracing.h"
+
+static Counter& wallet_reloads = metrics().counter(
+    "wallet_store_reloads_total", "Resident wallets reloaded after another process changed them");
+static Counter& wallet_update_retries = metrics().counter(
+    "wallet_store_update_retries_total", "Updates run again because another process wrote the wallet first");
+static Counter& wallet_hits = metrics().counter(
+    "wallet_store_lookups_total", "Wallet lookups by whether the wallet was resident", {{"result", "hit"}});
+static Counter& wallet_misses = metrics().counter(
+    "wallet_store_lookups_total", "Wallet lookups by whether the wallet was resident", {{"result", "miss"}});
+static Counter& wallet_evictions = metrics().counter(
+    "wallet_store_evictions_total", "Wallets evicted to stay within the capacity");
+
+// Global counter so a reloaded wallet never reuses an old version
+static std::atomic<uint64_t> version_counter{0};
+
+uint64_t WalletStore::nextVersion() {
+    return version_counter.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+bool WalletStore::reload(const std::string& user_id, UserWallet& wallet) {
+    Balances balances;
+    int64_t db_version = 0;
+    if (!loadWalletFromDB(user_id, balances, db_version)) {
+        LOG_ERROR("Failed to load wallet for user %s", user_id.c_str());
+        return false;
+    }
+    wallet.balances = std::move(balances);
+    wallet.version = nextVersion();
+    wallet.db_version.store(db_version, std::memory_order_relaxed);
+    wallet.stale.store(false, std::memory_order_release);
+    return true;
+}
+
+WalletUpdate WalletStore::save(const std::string& user_id, UserWallet& wallet, Balances& updated) {
+    TRACE_SPAN("wallet.save");
+
+    // Both sides are sorted by code, walk them like a merge
+    std::vector<DBMutation> mutations;
+    const Balances::Entry* old_entry = wallet.balances.begin();
+    const Balances::Entry* new_entry = updated.begin();
+    while (old_entry != wallet.balances.end() || new_entry != updated.end()) {
+        if (new_entry == updated.end() || (old_entry != wallet.balances.end() && old_entry->code < new_entry->code)) {
+            mutations.push_back({user_id, old_entry->code.str(), 0.0, true});
+            ++old_entry;
+        } else if (old_entry == wallet.balances.end() || new_entry->code < old_entry->code) {
+            mutations.push_back({user_id, new_entry->code.str(), new_entry->amount, false});
+            ++new_entry;
+        } else {
+            if (new_entry->amount != old_entry->amount) {
+                mutations.push_back({user_id, new_entry->code.str(), new_entry->amount, false});
+            }
+            ++old_entry;
+            ++new_entry;
+        }
+    }
+    if (mutations.empty()) {
+        return WalletUpdate::Ok;
+    }
+
+    int64_t new_version = 0;
+    switch (commitWalletToDB(user_id, wallet.db_version.load(std::memory_order_relaxed), mutations, new_version)) {
+        case DBWriteResult::Ok:
+            break;
+        case DBWriteResult::Conflict:
+            wallet_update_retries.inc();
+            return WalletUpdate::Conflict;
+        case DBWriteResult::Failed:
+            return WalletUpdate::SaveFailed;
+    }
+
+    std::swap(wallet.balances, updated);
+    wallet.version = nextVersion();
+    wallet.db_version.store(new_version, std::memory_order_relaxed);
+    // The version lets the totals skip a change a concurrent rebuild loaded already
+    exposure().apply(updated, wallet.balances, new_version);
+    streamHub().notifyUser(user_id);
+    return WalletUpdate::Ok;
+}
+
+WalletStore::WalletStore(size_t shard_count) : shards_(shard_count > 0 ? shard_count : 1) {}
+
+void WalletStore::setCapacity(size_t max_wallets) {
+    capacity_ = max_wallets;
+    shard_capacity_ = (max_wallets + shards_.size() - 1) / shards_.size();
+}
+
+void WalletStore::setEvictionListener(std::function<void(const std::vector<std::string>& user_ids)> listener) {
+    eviction_listener_ = std::move(listener);
+}
+
+void WalletStore::admit(Shard& shard, const std::shared_ptr<UserWallet>& wallet, std::vector<std::string>& evicted) {
+    if (shard_capacity_ == 0) {
+        return;
+    }
+    if (shard.clock.size() < shard_capacity_) {
+        shard.clock.push_back(wallet);
+        return;
+    }
+
+    // Two turns of the hand: the first may only clear reference bits
+    for (size_t step = 0; step < 2 * shard.clock.size(); step++) {
+        std::shared_ptr<UserWallet>& candidate = shard.clock[shard.hand];
+        shard.hand = (shard.hand + 1) % shard.clock.size();
+
+        // The index and the clock hold one reference each, any other is a request using it.
+        // No new ones can appear while the shard is locked exclusively
+        if (candidate.use_count() > 2 || candidate->referenced.exchange(false, std::memory_order_relaxed)) {
+            continue;
+        }
+        evicted.push_back(candidate->user_id);
+        shard.users.erase(candidate->user_id);
+        candidate = wallet;
+        wallet_evictions.inc();
+        return;
+    }
+    shard.clock.push_back(wallet);
+}
+
+WalletStore::Shard& WalletStore::shardFor(const std::string& user_id) {
+    return shards_[std::hash<std::string>{}(user_id) % shards_.size()];
+}
+
+std::shared_ptr<UserWallet> WalletStore::acquire(const std::string& user_id) {
+    Shard& shard = shardFor(user_id);
+    std::shared_ptr<UserWallet> wallet;
+
+    // Fast path: user already known
+    {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        auto it = shard.users.find(user_id);
+        if (it != shard.users.end()) {
+            wallet = it->second;
+        }
+    }
+
+    if (!wallet) {
+        std::vector<std::string> evicted;
+        {
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            auto& slot = shard.users[user_id];
+            if (!slot) {
+                slot = std::make_shared<UserWallet>();
+                slot->user_id = user_id;
+                wallet = slot;
+                admit(shard, wallet, evicted);
+            } else {
+                wallet = slot;
+            }
+        }
+        if (!evicted.empty() && eviction_listener_) {
+            eviction_listener_(evicted);
+        }
+    }
+
+    // Only written when it changes, a hot wallet's cache line stays shared between readers
+    if (!wallet->referenced.load(std::memory_order_relaxed)) {
+        wallet->referenced.store(true, std::memory_order_relaxed);
+    }
+
+    if (wallet->loaded.load(std::memory_order_acquire) && !wallet->stale.load(std::memory_order_acquire)) {
+        wallet_hits.inc();
+        return wallet;
+    }
+    wallet_misses.inc();
+
+    // First access or changed elsewhere: racing requests wait here while one of them loads
+    std::unique_lock<std::shared_mutex> lock(wallet->mutex);
+    bool loaded = wallet->loaded.load(std::memory_order_relaxed);
+    if (!loaded || wallet->stale.load(std::memory_order_relaxed)) {
+        if (!reload(user_id, *wallet)) {
+            return nullptr;
+        }
+        if (loaded) {
+            wallet_reloads.inc();
+        }
+        wallet->loaded.store(true, std::memory_order_release);
+    }
+    return wallet;
+}
+
+bool WalletStore::preload(const std::string& user_id, Balances& balances, int64_t db_version) {
+    Shard& shard = shardFor(user_id);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    if (shard_capacity_ != 0 && shard.clock.size() >= shard_capacity_) {
+        return false;
+    }
+    auto& slot = shard.users[user_id];
+    if (slot) {
+        return false;
+    }
+    slot = std::make_shared<UserWallet>();
+    slot->user_id = user_id;
+    if (shard_capacity_ != 0) {
+        shard.clock.push_back(slot);
+    }
+    slot->balances = std::move(balances);
+    slot->version = nextVersion();
+    slot->db_version.store(db_version, std::memory_order_relaxed);
+    slot->loaded.store(true, std::memory_order_release);
+    return true;
+}
+
+void WalletStore::invalidate(const std::string& user_id, int64_t db_version) {
+    Shard& shard = shardFor(user_id);
+    std::shared_ptr<UserWallet> wallet;
+    {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        auto it = shard.users.find(user_id);
+        if (it == shard.users.end()) {
+            return;     // not resident, its first load reads the new rows anyway
+        }
+        wallet = it->second;
+    }
+    if (wallet->db_version.load(std::memory_order_relaxed) < db_version) {
+        wallet->stale.store(true, std::memory_order_release);
+    }
+}
+
+WalletStoreStats WalletStore::stats() const {
+    WalletStoreStats stats;
+    stats.hits = wallet_hits.value();
+    stats.misses = wallet_misses.value();
+    stats.evictions = wallet_evictions.value();
+    stats.resident = size();
+    stats.capacity = capacity_;
+    return stats;
+}
+
+size_t WalletStore::size() const {
+    size_t total = 0;
+    for (const Shard& shard : shards_) {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        total += shard.users.size();
+    }
+    return total;
+}
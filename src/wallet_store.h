@@ -0,0 +1,135 @@
+#ifndef WALLET_STORE_H
+#define WALLET_STORE_H
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <functional>
+#include "currency.h"
+
+#define WALLET_STORE_SHARDS     16
+#define WALLET_UPDATE_ATTEMPTS  3       // reload-and-retry rounds when another process wrote the wallet first
+
+// Balances of one user, guarded by its own lock
+struct UserWallet {
+    std::string user_id;
+    std::shared_mutex mutex;
+    Balances balances;
+    uint64_t version = 0;       // changes on every update, unique within the process
+    std::atomic<int64_t> db_version{0};     // database version the balances were read at or written as
+    std::atomic<bool> loaded{false};
+    std::atomic<bool> stale{false};         // another process wrote it, reload before the next use
+    std::atomic<bool> referenced{false};    // used since the eviction hand last passed it
+};
+
+// Cache effectiveness, hits and misses count wallet lookups
+struct WalletStoreStats {
+    uint64_t hits;
+    uint64_t misses;        // loaded from the database: first use, after eviction or changed elsewhere
+    uint64_t evictions;
+    size_t resident;
+    size_t capacity;        // 0 is unlimited
+};
+
+enum class WalletUpdate {
+    Ok,
+    LoadFailed,
+    SaveFailed,
+    Conflict        // another process kept winning the race for the wallet
+};
+
+// In-memory wallets split into shards by user_id
+// Shard locks only guard the user index, balances are locked per user
+// With a capacity, each shard evicts cold wallets with CLOCK (second chance) to make room
+class WalletStore {
+public:
+    explicit WalletStore(size_t shard_count = WALLET_STORE_SHARDS);
+
+    // Keep at most about max_wallets resident (split evenly over the shards), 0 for no limit
+    // Wallets in use are never evicted, a shard whose wallets are all in use goes over its share
+    // Call before serving requests
+    void setCapacity(size_t max_wallets);
+
+    // Called with the user ids evicted by one lookup, outside of the store's locks
+    void setEvictionListener(std::function<void(const std::vector<std::string>& user_ids)> listener);
+
+    // Call fn(const balances&, version) under a shared lock, concurrent readers don't block each other
+    // Returns false if the wallet could not be loaded from database
+    template <typename Fn>
+    bool read(const std::string& user_id, Fn&& fn) {
+        std::shared_ptr<UserWallet> wallet = acquire(user_id);
+        if (!wallet) {
+            return false;
+        }
+        std::shared_lock<std::shared_mutex> lock(wallet->mutex);
+        fn(static_cast<const Balances&>(wallet->balances), wallet->version);
+        return true;
+    }
+
+    // Call fn(balances&) on a copy under an exclusive lock, then save the difference to database
+    // The copy replaces the wallet only once it is durable. If another process changed the wallet
+    // since it was read, it is reloaded and fn runs again, so fn must not have side effects
+    // A saved change is applied to the global exposure totals and streams are notified
+    template <typename Fn>
+    WalletUpdate update(const std::string& user_id, Fn&& fn) {
+        std::shared_ptr<UserWallet> wallet = acquire(user_id);
+        if (!wallet) {
+            return WalletUpdate::LoadFailed;
+        }
+        std::unique_lock<std::shared_mutex> lock(wallet->mutex);
+        for (int attempt = 1;; attempt++) {
+            Balances updated = wallet->balances;
+            fn(updated);
+            WalletUpdate result = save(user_id, *wallet, updated);
+            if (result != WalletUpdate::Conflict || attempt == WALLET_UPDATE_ATTEMPTS) {
+                return result;
+            }
+            if (!reload(user_id, *wallet)) {
+                return WalletUpdate::LoadFailed;
+            }
+        }
+    }
+
+    // Install a wallet read at startup so its first request skips the database
+    // Returns false if the user is already resident or its shard is full, preloading never evicts
+    bool preload(const std::string& user_id, Balances& balances, int64_t db_version);
+
+    // Another process wrote the wallet as db_version, a resident copy older than that is reloaded on next use
+    void invalidate(const std::string& user_id, int64_t db_version);
+
+    // Number of resident wallets
+    size_t size() const;
+
+    WalletStoreStats stats() const;
+
+private:
+    struct Shard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<std::string, std::shared_ptr<UserWallet>> users;
+        std::vector<std::shared_ptr<UserWallet>> clock;     // resident wallets in eviction order, with a capacity only
+        size_t hand = 0;
+    };
+
+    // Give a new wallet a place in the shard's clock, evicting one if the shard is full
+    // With the shard's exclusive lock held
+    void admit(Shard& shard, const std::shared_ptr<UserWallet>& wallet, std::vector<std::string>& evicted);
+
+    // Find or create the user's wallet and load it from database once
+    std::shared_ptr<UserWallet> acquire(const std::string& user_id);
+    Shard& shardFor(const std::string& user_id);
+    static uint64_t nextVersion();
+    // Both with the wallet's exclusive lock held
+    static bool reload(const std::string& user_id, UserWallet& wallet);
+    static WalletUpdate save(const std::string& user_id, UserWallet& wallet, Balances& updated);
+
+    std::vector<Shard> shards_;
+    size_t capacity_ = 0;
+    size_t shard_capacity_ = 0;
+    std::function<void(const std::vector<std::string>&)> eviction_listener_;
+};
+
+#endif // WALLET_STORE_H
@@ -0,0 +1,164 @@
+#include "worker_pool.h"
+#include "metrics.h"
+#include "logger.h"
+
+static thread_local bool shedding_thread = false;
+static thread_local WorkerPool* current_pool = nullptr;
+static thread_local bool released_thread = false;
+
+static Gauge& queue_depth = metrics().gauge(
+    "wallet_server_queue_depth", "Connections waiting for a worker");
+static Gauge& busy_workers = metrics().gauge(
+    "wallet_server_busy_workers", "Workers serving a connection");
+static Gauge& worker_count = metrics().gauge(
+    "wallet_server_workers", "Size of the worker pool");
+static Gauge& stream_count = metrics().gauge(
+    "wallet_server_streams", "Connections streaming on their own thread");
+static Counter& accepted_connections = metrics().counter(
+    "wallet_server_connections_total", "Accepted connections", {{"result", "queued"}});
+static Counter& shed_connections = metrics().counter(
+    "wallet_server_connections_total", "Accepted connections", {{"result", "shed"}});
+static Counter& dropped_connections = metrics().counter(
+    "wallet_server_connections_total", "Accepted connections", {{"result", "dropped"}});
+
+bool isSheddingThread() {
+    return shedding_thread;
+}
+
+bool releaseWorkerForStream() {
+    if (current_pool == nullptr || shedding_thread || released_thread) {
+        return released_thread;
+    }
+    return current_pool->releaseCurrentWorker();
+}
+
+WorkerPool::WorkerPool(size_t workers, size_t max_queued, size_t max_streams) : max_streams_(max_streams) {
+    workers_.max_queued = max_queued;
+    shed_.max_queued = SERVER_SHED_QUEUE;
+
+    worker_count.set(static_cast<int64_t>(workers));
+    for (size_t i = 0; i < workers; i++) {
+        workers_.threads.emplace_back(&WorkerPool::run, this, std::ref(workers_), false);
+    }
+    for (size_t i = 0; i < SERVER_SHED_THREADS; i++) {
+        shed_.threads.emplace_back(&WorkerPool::run, this, std::ref(shed_), true);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    shutdown();
+}
+
+bool WorkerPool::push(Lane& lane, std::function<void()>& fn) {
+    {
+        std::lock_guard<std::mutex> lock(lane.mutex);
+        if (lane.stopping || lane.tasks.size() >= lane.max_queued) {
+            return false;
+        }
+        lane.tasks.push_back(std::move(fn));
+    }
+    lane.cond.notify_one();
+    return true;
+}
+
+bool WorkerPool::enqueue(std::function<void()> fn) {
+    if (push(workers_, fn)) {
+        accepted_connections.inc();
+        queue_depth.inc();
+        return true;
+    }
+
+    if (push(shed_, fn)) {
+        shed_connections.inc();
+        LOG_DEBUG("Worker queue full, shedding connection");
+        return true;
+    }
+
+    // httplib closes the socket
+    dropped_connections.inc();
+    LOG_WARN("Worker and shed queues full, dropping connection");
+    return false;
+}
+
+bool WorkerPool::releaseCurrentWorker() {
+    std::lock_guard<std::mutex> lock(workers_.mutex);
+    if (workers_.stopping || streams_ >= max_streams_) {
+        return false;
+    }
+
+    // Join streams that ended since the last release so the thread list stays bounded
+    for (std::thread::id id : workers_.exited) {
+        for (auto it = workers_.threads.begin(); it != workers_.threads.end(); ++it) {
+            if (it->get_id() == id) {
+                it->join();
+                workers_.threads.erase(it);
+                break;
+            }
+        }
+    }
+    workers_.exited.clear();
+
+    workers_.threads.emplace_back(&WorkerPool::run, this, std::ref(workers_), false);
+    streams_++;
+    released_thread = true;
+    busy_workers.dec();
+    stream_count.inc();
+    return true;
+}
+
+void WorkerPool::run(Lane& lane, bool shedding) {
+    shedding_thread = shedding;
+    current_pool = this;
+
+    for (;;) {
+        std::function<void()> fn;
+        {
+            std::unique_lock<std::mutex> lock(lane.mutex);
+            lane.cond.wait(lock, [&] { return lane.stopping || !lane.tasks.empty(); });
+            if (lane.tasks.empty()) {
+                return;
+            }
+            fn = std::move(lane.tasks.front());
+            lane.tasks.pop_front();
+        }
+
+        if (shedding) {
+            fn();
+            continue;
+        }
+
+        queue_depth.dec();
+        busy_workers.inc();
+        fn();
+        if (released_thread) {
+            // A replacement took this thread's place in the pool
+            std::lock_guard<std::mutex> lock(lane.mutex);
+            lane.exited.push_back(std::this_thread::get_id());
+            streams_--;
+            stream_count.dec();
+            return;
+        }
+        busy_workers.dec();
+    }
+}
+
+void WorkerPool::stop(Lane& lane) {
+    {
+        std::lock_guard<std::mutex> lock(lane.mutex);
+        lane.stopping = true;
+    }
+    lane.cond.notify_all();
+
+    // Pending connections are still served before the threads exit
+    for (auto& thread : lane.threads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+    lane.threads.clear();
+}
+
+void WorkerPool::shutdown() {
+    stop(workers_);
+    stop(shed_);
+}
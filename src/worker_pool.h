@@ -0,0 +1,69 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include "../third_party/httplib.h"
+
+#define SERVER_MIN_WORKERS          8       // workers block on SQLite commits and NBP, keep a floor on small machines
+#define SERVER_QUEUE_PER_WORKER     8       // pending connections per worker before shedding
+#define SERVER_SHED_THREADS         2       // threads answering shed connections with 503
+#define SERVER_SHED_QUEUE           256     // shed connections waiting for a 503, beyond that they are closed
+#define SERVER_KEEPALIVE_MAX        100     // requests per keep-alive connection
+#define SERVER_KEEPALIVE_TIMEOUT_SEC 2      // idle keep-alive connections give their worker back after this
+#define SERVER_RETRY_AFTER_SEC      1
+#define SERVER_MAX_STREAMS          1024    // long-lived streaming connections, each holds its own thread
+
+// Task queue for httplib::Server: a fixed set of workers and a bounded pending queue.
+// httplib hands over one task per accepted connection. When the pending queue is
+// full the connection goes to a small shed pool instead, whose requests are
+// answered with 503 (see isSheddingThread()). If that is full too, it is closed.
+// A streaming handler can hand its thread over to the stream and get a replacement
+// worker started (see releaseWorkerForStream()), so streams never starve the pool.
+class WorkerPool : public httplib::TaskQueue {
+public:
+    WorkerPool(size_t workers, size_t max_queued, size_t max_streams = SERVER_MAX_STREAMS);
+    ~WorkerPool() override;
+
+    bool enqueue(std::function<void()> fn) override;
+    void shutdown() override;
+
+    // Start a replacement for the calling worker, which exits once its connection is done
+    // Returns false if the stream limit is reached or the pool is stopping
+    bool releaseCurrentWorker();
+
+private:
+    // FIFO of tasks served by its own threads
+    struct Lane {
+        std::deque<std::function<void()>> tasks;
+        size_t max_queued = 0;
+        bool stopping = false;
+        std::mutex mutex;
+        std::condition_variable cond;
+        std::vector<std::thread> threads;
+        std::vector<std::thread::id> exited;    // released threads that finished, joined on the next release
+    };
+
+    bool push(Lane& lane, std::function<void()>& fn);
+    void run(Lane& lane, bool shedding);
+    void stop(Lane& lane);
+
+    Lane workers_;
+    Lane shed_;
+    size_t max_streams_;
+    size_t streams_ = 0;        // guarded by workers_.mutex
+};
+
+// True while serving a connection the worker pool shed, the request should get a 503
+bool isSheddingThread();
+
+// Call from a handler before starting a long-lived stream on this connection
+// Returns false if the connection can't be streamed (too many streams, shed or not a pool thread)
+bool releaseWorkerForStream();
+
+#endif // WORKER_POOL_H